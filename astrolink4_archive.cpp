@@ -0,0 +1,381 @@
+/*******************************************************************************
+ Copyright(c) 2019 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+#include "astrolink4_archive.h"
+#include "astrolink4_history.h"
+#include "astrolink4_protocol.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Astrolink4
+{
+
+namespace
+{
+
+struct ColumnSpec
+{
+    const char *name;
+    uint32_t type;
+    uint32_t width;
+};
+
+// archived columns, the order is the file format
+const ColumnSpec COLUMNS[] =
+{
+    { "time_ms", ArchiveColumn::U64, 8 },
+    { "position", ArchiveColumn::I32, 4 },
+    { "current", ArchiveColumn::F32, 4 },
+    { "vin", ArchiveColumn::F32, 4 },
+    { "vreg", ArchiveColumn::F32, 4 },
+    { "ah", ArchiveColumn::F32, 4 },
+    { "wh", ArchiveColumn::F32, 4 },
+    { "sens1_temp", ArchiveColumn::F32, 4 },
+    { "sens1_hum", ArchiveColumn::F32, 4 },
+    { "sens1_dew", ArchiveColumn::F32, 4 },
+    { "sens2_temp", ArchiveColumn::F32, 4 },
+    { "pwm1", ArchiveColumn::U8, 1 },
+    { "pwm2", ArchiveColumn::U8, 1 },
+    { "outputs", ArchiveColumn::U8, 1 },
+    { "flags", ArchiveColumn::U8, 1 }
+};
+const uint32_t COLUMN_COUNT = sizeof(COLUMNS) / sizeof(COLUMNS[0]);
+
+static_assert(sizeof(ArchiveHeader) <= ASTROLINK4_ARCHIVE_HEADER, "archive header exceeds its page");
+static_assert(sizeof(COLUMNS) / sizeof(COLUMNS[0]) <= ASTROLINK4_ARCHIVE_COLUMNS, "too many archive columns");
+
+uint64_t rowSize()
+{
+    uint64_t size = 0;
+    for (uint32_t i = 0; i < COLUMN_COUNT; i++)
+        size += COLUMNS[i].width;
+    return size;
+}
+
+// columns start 8 byte aligned after the header, in table order
+uint64_t columnOffset(uint64_t capacity, uint32_t column)
+{
+    uint64_t offset = ASTROLINK4_ARCHIVE_HEADER;
+    for (uint32_t i = 0; i < column; i++)
+        offset += (capacity * COLUMNS[i].width + 7) & ~uint64_t(7);
+    return offset;
+}
+
+uint64_t fileSize(uint64_t capacity)
+{
+    return columnOffset(capacity, COLUMN_COUNT);
+}
+
+// the offsets in the file are used as they are, each must be the one the layout gives
+bool compatible(const ArchiveHeader *header, uint64_t length)
+{
+    // every column takes at least a byte per row, a larger capacity would overflow the size
+    if (memcmp(header->magic, "AL4A", 4) != 0 || header->version != ASTROLINK4_ARCHIVE_VERSION ||
+            header->columnCount != COLUMN_COUNT || header->capacity > length ||
+            fileSize(header->capacity) != length || header->rows > header->capacity)
+        return false;
+    for (uint32_t i = 0; i < COLUMN_COUNT; i++)
+    {
+        if (strncmp(header->columns[i].name, COLUMNS[i].name, sizeof(header->columns[i].name)) != 0 ||
+                header->columns[i].type != COLUMNS[i].type || header->columns[i].width != COLUMNS[i].width ||
+                header->columns[i].offset != columnOffset(header->capacity, i))
+            return false;
+    }
+    return true;
+}
+
+template <class T>
+void store(char *base, const ArchiveColumn &column, uint64_t row, T value)
+{
+    memcpy(base + column.offset + row * sizeof(T), &value, sizeof(T));
+}
+
+uint8_t toByte(double value)
+{
+    return static_cast<uint8_t>(std::max(0.0, std::min(255.0, value + 0.5)));
+}
+
+}
+
+TelemetryArchive::TelemetryArchive()
+{
+}
+
+TelemetryArchive::~TelemetryArchive()
+{
+    close();
+}
+
+bool TelemetryArchive::open(const std::string &path, uint64_t maxBytes, int keep)
+{
+    close();
+    this->path = path;
+    this->maxBytes = maxBytes;
+    this->keep = std::max(0, keep);
+    if (map(false))
+        return true;
+    // nothing usable on disk, keep whatever is there as an old file and start a new one
+    struct stat info;
+    if (stat(path.c_str(), &info) == 0 && !rotate())
+        return false;
+    return map(true);
+}
+
+void TelemetryArchive::close()
+{
+    if (base)
+        munmap(base, length);
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+    base = nullptr;
+    length = 0;
+    header = nullptr;
+}
+
+bool TelemetryArchive::map(bool create)
+{
+    uint64_t capacity = 0;
+    if (create)
+    {
+        capacity = std::max<uint64_t>(1, (maxBytes > ASTROLINK4_ARCHIVE_HEADER ? maxBytes - ASTROLINK4_ARCHIVE_HEADER : 0) / rowSize());
+        length = fileSize(capacity);
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        // blocks are reserved up front, a full disk fails here instead of faulting a later store
+        if (fd < 0 || posix_fallocate(fd, 0, length) != 0)
+        {
+            close();
+            return false;
+        }
+    }
+    else
+    {
+        fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+        struct stat info;
+        if (fd < 0 || fstat(fd, &info) != 0 || static_cast<uint64_t>(info.st_size) < ASTROLINK4_ARCHIVE_HEADER)
+        {
+            close();
+            return false;
+        }
+        length = info.st_size;
+    }
+
+    void *mapping = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED)
+    {
+        close();
+        return false;
+    }
+    base = static_cast<char *>(mapping);
+    header = reinterpret_cast<ArchiveHeader *>(base);
+
+    if (!create)
+    {
+        if (!compatible(header, length) || header->rows >= header->capacity)
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    memcpy(header->magic, "AL4A", 4);
+    header->version = ASTROLINK4_ARCHIVE_VERSION;
+    header->columnCount = COLUMN_COUNT;
+    header->capacity = capacity;
+    for (uint32_t i = 0; i < COLUMN_COUNT; i++)
+    {
+        ArchiveColumn &column = header->columns[i];
+        strncpy(column.name, COLUMNS[i].name, sizeof(column.name) - 1);
+        column.type = COLUMNS[i].type;
+        column.width = COLUMNS[i].width;
+        column.offset = columnOffset(capacity, i);
+    }
+    __atomic_store_n(&header->rows, 0, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool TelemetryArchive::rotate()
+{
+    close();
+    // <path>.keep is overwritten by the rename from <path>.(keep - 1)
+    for (int i = keep; i > 0; i--)
+    {
+        std::string from = i > 1 ? path + "." + std::to_string(i - 1) : path;
+        std::string to = path + "." + std::to_string(i);
+        if (rename(from.c_str(), to.c_str()) != 0 && i == 1)
+            return false;
+    }
+    if (keep == 0)
+        unlink(path.c_str());
+    return true;
+}
+
+bool TelemetryArchive::append(const QFrame &frame, uint64_t timeMs)
+{
+    if (!header)
+        return false;
+    uint64_t row = header->rows;
+    if (row >= header->capacity)
+    {
+        if (!rotate() || !map(true))
+            return false;
+        row = 0;
+    }
+
+    uint8_t outputs = (frame.out1 ? 1 : 0) | (frame.out2 ? 2 : 0) | (frame.out3 ? 4 : 0);
+    uint8_t flags = TelemetrySample::FULL_FRAME;
+    if (frame.sens1Type > 0)
+        flags |= TelemetrySample::SENSOR1;
+    if (frame.sens2Type > 0)
+        flags |= TelemetrySample::SENSOR2;
+    if (frame.stepsToGo != 0 || frame.dcMove)
+        flags |= TelemetrySample::MOVING;
+
+    const ArchiveColumn *columns = header->columns;
+    store<uint64_t>(base, columns[0], row, timeMs);
+    store<int32_t>(base, columns[1], row, frame.stepperPos);
+    store<float>(base, columns[2], row, frame.current);
+    store<float>(base, columns[3], row, frame.vin);
+    store<float>(base, columns[4], row, frame.vreg);
+    store<float>(base, columns[5], row, frame.ah);
+    store<float>(base, columns[6], row, frame.wh);
+    store<float>(base, columns[7], row, frame.sens1Temp);
+    store<float>(base, columns[8], row, frame.sens1Hum);
+    store<float>(base, columns[9], row, frame.sens1Dew);
+    store<float>(base, columns[10], row, frame.sens2Temp);
+    store<uint8_t>(base, columns[11], row, toByte(frame.pwm1));
+    store<uint8_t>(base, columns[12], row, toByte(frame.pwm2));
+    store<uint8_t>(base, columns[13], row, outputs);
+    store<uint8_t>(base, columns[14], row, flags);
+    __atomic_store_n(&header->rows, row + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+uint64_t TelemetryArchive::rows() const
+{
+    return header ? __atomic_load_n(&header->rows, __ATOMIC_ACQUIRE) : 0;
+}
+
+ArchiveView::ArchiveView()
+{
+}
+
+ArchiveView::~ArchiveView()
+{
+    close();
+}
+
+bool ArchiveView::open(const std::string &path)
+{
+    close();
+    fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0 || static_cast<uint64_t>(info.st_size) < ASTROLINK4_ARCHIVE_HEADER)
+    {
+        close();
+        return false;
+    }
+    length = info.st_size;
+    void *mapping = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED)
+    {
+        close();
+        return false;
+    }
+    base = static_cast<const char *>(mapping);
+    header = reinterpret_cast<const ArchiveHeader *>(base);
+    if (!compatible(header, length))
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void ArchiveView::close()
+{
+    if (base)
+        munmap(const_cast<char *>(base), length);
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+    base = nullptr;
+    length = 0;
+    header = nullptr;
+}
+
+uint64_t ArchiveView::rows() const
+{
+    // the file stays writable by others after it was checked
+    return header ? std::min<uint64_t>(__atomic_load_n(&header->rows, __ATOMIC_ACQUIRE), header->capacity) : 0;
+}
+
+uint32_t ArchiveView::columnCount() const
+{
+    return header ? header->columnCount : 0;
+}
+
+const char *ArchiveView::columnName(uint32_t column) const
+{
+    return header->columns[column].name;
+}
+
+bool ArchiveView::isInteger(uint32_t column) const
+{
+    return header->columns[column].type != ArchiveColumn::F32;
+}
+
+double ArchiveView::value(uint32_t column, uint64_t row) const
+{
+    const ArchiveColumn &info = header->columns[column];
+    const char *at = base + info.offset + row * info.width;
+    switch (info.type)
+    {
+        case ArchiveColumn::U8:
+            return static_cast<uint8_t>(*at);
+        case ArchiveColumn::I32:
+        {
+            int32_t value;
+            memcpy(&value, at, sizeof(value));
+            return value;
+        }
+        case ArchiveColumn::F32:
+        {
+            float value;
+            memcpy(&value, at, sizeof(value));
+            return value;
+        }
+        case ArchiveColumn::U64:
+        {
+            uint64_t value;
+            memcpy(&value, at, sizeof(value));
+            return static_cast<double>(value);
+        }
+        default:
+            return 0;
+    }
+}
+
+}
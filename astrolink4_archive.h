@@ -0,0 +1,121 @@
+/*******************************************************************************
+ Copyright(c) 2019 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef ASTROLINK4_ARCHIVE_H
+#define ASTROLINK4_ARCHIVE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#define ASTROLINK4_ARCHIVE_VERSION	1
+#define ASTROLINK4_ARCHIVE_HEADER	4096
+#define ASTROLINK4_ARCHIVE_COLUMNS	32
+
+namespace Astrolink4
+{
+
+struct QFrame;
+
+// On disk layout, native byte order. The header takes the first page, each column
+// is one fixed width array of `capacity` values at its own offset. Rows below
+// `rows` are complete, the writer bumps it with a release store after each row.
+struct ArchiveColumn
+{
+    enum Type
+    {
+        U8 = 1, I32 = 2, F32 = 3, U64 = 4
+    };
+    char name[16];
+    uint32_t type;
+    uint32_t width;
+    uint64_t offset;
+};
+
+struct ArchiveHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t columnCount;
+    uint32_t reserved;
+    uint64_t capacity;
+    uint64_t rows;
+    ArchiveColumn columns[ASTROLINK4_ARCHIVE_COLUMNS];
+};
+
+// Columnar archive of full 'q' frames in a memory mapped file. The file is
+// preallocated, appending a row only stores into the mapping. A full file is
+// rotated to <path>.1, <path>.2, ... keeping the configured number of old files.
+class TelemetryArchive
+{
+public:
+    TelemetryArchive();
+    ~TelemetryArchive();
+
+    // continues an existing compatible file, an incompatible one is rotated away
+    bool open(const std::string &path, uint64_t maxBytes, int keep);
+    void close();
+    bool isOpen() const
+    {
+        return header != nullptr;
+    }
+
+    bool append(const QFrame &frame, uint64_t timeMs);
+    uint64_t rows() const;
+
+private:
+    bool map(bool create);
+    bool rotate();
+
+    std::string path;
+    uint64_t maxBytes { 0 };
+    int keep { 0 };
+    int fd { -1 };
+    char *base { nullptr };
+    size_t length { 0 };
+    ArchiveHeader *header { nullptr };
+};
+
+// Read only view of an archive file, possibly still written by the driver.
+// Values are read straight from the mapping, nothing is copied.
+class ArchiveView
+{
+public:
+    ArchiveView();
+    ~ArchiveView();
+
+    bool open(const std::string &path);
+    void close();
+
+    // rows committed by the writer so far
+    uint64_t rows() const;
+    uint32_t columnCount() const;
+    const char *columnName(uint32_t column) const;
+    bool isInteger(uint32_t column) const;
+    double value(uint32_t column, uint64_t row) const;
+
+private:
+    int fd { -1 };
+    const char *base { nullptr };
+    size_t length { 0 };
+    const ArchiveHeader *header { nullptr };
+};
+
+}
+
+#endif
@@ -0,0 +1,97 @@
+/*******************************************************************************
+ Copyright(c) 2019 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+// Prints a telemetry archive written by the driver as CSV, the file may still be written.
+
+#include "astrolink4_archive.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+
+#include <getopt.h>
+
+namespace
+{
+
+void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-t rows] archive...\n"
+            "  -t  print only the last rows of each archive\n", name);
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t tail = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 't': tail = strtoull(optarg, nullptr, 10); break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind >= argc)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int result = 0;
+    bool printedHeader = false;
+    for (int i = optind; i < argc; i++)
+    {
+        Astrolink4::ArchiveView view;
+        if (!view.open(argv[i]))
+        {
+            fprintf(stderr, "%s: not a telemetry archive\n", argv[i]);
+            result = 1;
+            continue;
+        }
+
+        uint32_t columns = view.columnCount();
+        if (!printedHeader)
+        {
+            for (uint32_t c = 0; c < columns; c++)
+                printf("%s%s", c ? "," : "", view.columnName(c));
+            printf("\n");
+            printedHeader = true;
+        }
+
+        // rows appended after this point are left for the next run
+        uint64_t rows = view.rows();
+        for (uint64_t row = (tail && tail < rows) ? rows - tail : 0; row < rows; row++)
+        {
+            for (uint32_t c = 0; c < columns; c++)
+            {
+                double value = view.value(c, row);
+                if (view.isInteger(c))
+                    printf("%s%.0f", c ? "," : "", value);
+                else
+                    printf("%s%.3f", c ? "," : "", value);
+            }
+            printf("\n");
+        }
+    }
+    return result;
+}
@@ -0,0 +1,72 @@
+/*******************************************************************************
+ Copyright(c) 2019 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+#include "astrolink4_compensation.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Astrolink4
+{
+
+TemperatureCompensator::TemperatureCompensator()
+{
+    reset();
+}
+
+void TemperatureCompensator::reset()
+{
+    valid = false;
+    average = 0;
+    reference = 0;
+    carried = 0;
+}
+
+void TemperatureCompensator::update(double temperature, double dt, double timeConstant)
+{
+    if (!std::isfinite(temperature))
+        return;
+    if (!valid)
+    {
+        average = reference = temperature;
+        valid = true;
+        return;
+    }
+    // the weight follows the sample interval, irregular polling keeps the same time constant
+    double alpha = timeConstant > 0 ? 1.0 - std::exp(-std::max(0.0, dt) / timeConstant) : 1.0;
+    average += alpha * (temperature - average);
+}
+
+double TemperatureCompensator::pending(double stepsPerDegree) const
+{
+    if (!valid)
+        return 0;
+    return (average - reference) * stepsPerDegree + carried;
+}
+
+int32_t TemperatureCompensator::release(double stepsPerDegree, double threshold)
+{
+    double owed = pending(stepsPerDegree);
+    if (!valid || std::fabs(owed) < std::max(1.0, threshold))
+        return 0;
+    int32_t steps = static_cast<int32_t>(std::trunc(owed));
+    carried = owed - steps;
+    reference = average;
+    return steps;
+}
+
+}
@@ -0,0 +1,67 @@
+/*******************************************************************************
+ Copyright(c) 2019 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef ASTROLINK4_COMPENSATION_H
+#define ASTROLINK4_COMPENSATION_H
+
+#include <cstdint>
+
+namespace Astrolink4
+{
+
+// Temperature compensation done by the driver. Sensor noise is smoothed with an
+// exponential moving average, the steps owed for the filtered temperature change
+// are accumulated with their fraction and released as one move at the threshold.
+class TemperatureCompensator
+{
+public:
+    TemperatureCompensator();
+
+    // forget the filter and the steps owed, the next sample becomes the reference
+    void reset();
+
+    // feeds one temperature sample taken dt seconds after the previous one
+    void update(double temperature, double dt, double timeConstant);
+
+    // steps owed so far, including the fraction carried from earlier moves
+    double pending(double stepsPerDegree) const;
+
+    // whole steps to move now, zero while the steps owed stay below the threshold;
+    // the fraction not moved is carried over to the next move
+    int32_t release(double stepsPerDegree, double threshold);
+
+    bool isValid() const
+    {
+        return valid;
+    }
+    double filtered() const
+    {
+        return average;
+    }
+
+private:
+    bool valid;
+    double average;
+    // filtered temperature the steps owed are measured from
+    double reference;
+    double carried;
+};
+
+}
+
+#endif
@@ -0,0 +1,229 @@
+/*******************************************************************************
+ Copyright(c) 2019 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+#include "astrolink4_config.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace Astrolink4
+{
+
+ConfigWriter::~ConfigWriter()
+{
+    stop();
+}
+
+void ConfigWriter::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopped = true;
+        if (!running)
+            return;
+        running = false;
+    }
+    changed.notify_all();
+    if (thread.joinable())
+        thread.join();
+}
+
+void ConfigWriter::submit(const std::string &path, const std::string &data, bool announceWrite, Callback callback)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    Clock::time_point now = Clock::now();
+    File &file = files[path];
+    if (file.pending)
+        coalescedCount++;
+    else
+    {
+        file.firstSubmit = now;
+        file.announce = false;
+    }
+    file.pending = true;
+    file.content = data;
+    file.callback = callback;
+    file.announce = file.announce || announceWrite;
+    file.lastSubmit = now;
+
+    if (stopped)
+    {
+        // no writer thread any more, write on the caller
+        if (!file.writing)
+            writeFile(lock, path, file);
+        return;
+    }
+    if (!running)
+    {
+        running = true;
+        thread = std::thread(&ConfigWriter::run, this);
+    }
+    lock.unlock();
+    changed.notify_all();
+}
+
+bool ConfigWriter::flush(const std::string &path)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    std::map<std::string, File>::iterator it = files.find(path);
+    if (it == files.end())
+        return true;
+    File &file = it->second;
+    if (!running)
+    {
+        if (file.pending && !file.writing)
+            writeFile(lock, path, file);
+        return file.lastOk;
+    }
+    if (!file.pending && !file.writing)
+        return file.lastOk;
+    file.flushing = true;
+    changed.notify_all();
+    written.wait(lock, [&file]()
+    {
+        return !file.pending && !file.writing;
+    });
+    return file.lastOk;
+}
+
+uint64_t ConfigWriter::writes() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return writeCount;
+}
+
+uint64_t ConfigWriter::coalesced() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return coalescedCount;
+}
+
+void ConfigWriter::writeFile(std::unique_lock<std::mutex> &lock, const std::string &path, File &file)
+{
+    file.pending = false;
+    file.flushing = false;
+    file.writing = true;
+    std::string data;
+    data.swap(file.content);
+    bool announceWrite = file.announce;
+    // the owner may be gone once nothing is pending, the callback is not kept past the write
+    Callback callback;
+    callback.swap(file.callback);
+    lock.unlock();
+
+    bool ok = writeAtomically(path, data);
+    if (callback)
+        callback(ok, path, announceWrite);
+
+    lock.lock();
+    file.writing = false;
+    file.lastOk = ok;
+    writeCount++;
+    written.notify_all();
+}
+
+void ConfigWriter::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;)
+    {
+        // the file due first, now for all of them when stopping or asked to flush
+        std::map<std::string, File>::iterator next = files.end();
+        Clock::time_point nextDue;
+        for (std::map<std::string, File>::iterator it = files.begin(); it != files.end(); ++it)
+        {
+            const File &file = it->second;
+            if (!file.pending || file.writing)
+                continue;
+            Clock::time_point due = Clock::time_point::min();
+            if (running && !file.flushing)
+                due = std::min(file.lastSubmit + std::chrono::milliseconds(ASTROLINK4_CONFIG_QUIET),
+                               file.firstSubmit + std::chrono::milliseconds(ASTROLINK4_CONFIG_MAX_DELAY));
+            if (next == files.end() || due < nextDue)
+            {
+                next = it;
+                nextDue = due;
+            }
+        }
+
+        if (next == files.end())
+        {
+            if (!running)
+                return;
+            changed.wait(lock);
+            continue;
+        }
+        if (Clock::now() < nextDue)
+        {
+            changed.wait_until(lock, nextDue);
+            continue;
+        }
+        // map nodes stay valid while other files are submitted
+        writeFile(lock, next->first, next->second);
+    }
+}
+
+bool ConfigWriter::writeAtomically(const std::string &path, const std::string &content)
+{
+    std::string temp = path + ".tmp";
+    int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return false;
+
+    const char *data = content.data();
+    size_t left = content.size();
+    bool ok = true;
+    while (ok && left > 0)
+    {
+        ssize_t n = write(fd, data, left);
+        if (n < 0 && errno == EINTR)
+            continue;
+        ok = n > 0;
+        if (ok)
+        {
+            data += n;
+            left -= n;
+        }
+    }
+    // the data must be on disk before the rename makes it the config
+    ok = ok && fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+    if (!ok || rename(temp.c_str(), path.c_str()) != 0)
+    {
+        int error = errno;
+        unlink(temp.c_str());
+        errno = error;
+        return false;
+    }
+
+    // persist the rename itself
+    size_t slash = path.find_last_of('/');
+    std::string dir = slash == std::string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+    int dirFd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd >= 0)
+    {
+        fsync(dirFd);
+        close(dirFd);
+    }
+    return true;
+}
+
+}
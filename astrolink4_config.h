@@ -0,0 +1,101 @@
+/*******************************************************************************
+ Copyright(c) 2019 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef ASTROLINK4_CONFIG_H
+#define ASTROLINK4_CONFIG_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// changes closer together than this are written once [ms]
+#define ASTROLINK4_CONFIG_QUIET     1000
+// a steady stream of changes is still written at least this often [ms]
+#define ASTROLINK4_CONFIG_MAX_DELAY 10000
+
+namespace Astrolink4
+{
+
+// Writes the driver configuration files off the event loop thread, one writer
+// for all units of the process. The thread is started by the first submission.
+// Only the last submitted content of each file is kept, it is replaced with a rename.
+class ConfigWriter
+{
+public:
+    // called on the writer thread after each write
+    typedef std::function<void(bool ok, const std::string &path, bool announce)> Callback;
+
+    ConfigWriter() = default;
+    ~ConfigWriter();
+
+    ConfigWriter(const ConfigWriter &) = delete;
+    ConfigWriter &operator=(const ConfigWriter &) = delete;
+
+    // writes what is pending and waits for it, later submissions are written on the caller
+    void stop();
+
+    // announce is kept if any of the coalesced submissions asked for it
+    void submit(const std::string &path, const std::string &content, bool announce, Callback written);
+    // writes a pending submission of the file now and waits for it, false if the write failed
+    bool flush(const std::string &path);
+
+    uint64_t writes() const;
+    uint64_t coalesced() const;
+
+    // temporary file, fsync and rename, the old content stays intact on failure
+    static bool writeAtomically(const std::string &path, const std::string &content);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct File
+    {
+        std::string content;
+        Callback callback;
+        bool pending { false };
+        bool writing { false };
+        bool flushing { false };
+        bool announce { false };
+        bool lastOk { true };
+        Clock::time_point firstSubmit;
+        Clock::time_point lastSubmit;
+    };
+
+    void run();
+    // with the lock held, the lock is released during the write
+    void writeFile(std::unique_lock<std::mutex> &lock, const std::string &path, File &file);
+
+    std::thread thread;
+    mutable std::mutex mutex;
+    std::condition_variable changed;
+    std::condition_variable written;
+    bool running { false };
+    bool stopped { false };
+    std::map<std::string, File> files;
+    uint64_t writeCount { 0 };
+    uint64_t coalescedCount { 0 };
+};
+
+}
+
+#endif
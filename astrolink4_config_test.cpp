@@ -0,0 +1,112 @@
+/*******************************************************************************
+ Copyright(c) 2019 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+// ConfigWriter debounce: a burst of saves is written once, a flush writes
+// at once and a stopped writer writes on the caller. Exits non zero on failure.
+
+#include "astrolink4_config.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+
+namespace
+{
+
+int failures = 0;
+
+#define CHECK(condition) \
+    do { if (!(condition)) { fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #condition); failures++; } } while (0)
+
+std::string readFile(const std::string &path)
+{
+    std::ifstream in(path);
+    std::stringstream content;
+    content << in.rdbuf();
+    return content.str();
+}
+
+std::string snapshot(int i)
+{
+    return "<INDIDriver>" + std::to_string(i) + "</INDIDriver>\n";
+}
+
+}
+
+int main()
+{
+    char dir[] = "/tmp/astrolink4_config_testXXXXXX";
+    if (!mkdtemp(dir))
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    const std::string burstPath = std::string(dir) + "/burst.xml";
+    const std::string flushPath = std::string(dir) + "/flush.xml";
+
+    Astrolink4::ConfigWriter writer;
+    std::atomic<int> callbacks { 0 };
+    std::atomic<bool> announced { false };
+    Astrolink4::ConfigWriter::Callback written = [&](bool ok, const std::string &, bool announce)
+    {
+        CHECK(ok);
+        announced = announce;
+        callbacks++;
+    };
+
+    // ten saves within the quiet period, only the first asks to be announced
+    for (int i = 0; i < 10; i++)
+        writer.submit(burstPath, snapshot(i), i == 0, written);
+    std::this_thread::sleep_for(std::chrono::milliseconds(ASTROLINK4_CONFIG_QUIET * 2));
+    CHECK(writer.writes() == 1);
+    CHECK(writer.coalesced() == 9);
+    CHECK(callbacks == 1);
+    CHECK(announced);
+    CHECK(readFile(burstPath) == snapshot(9));
+
+    // a flush does not wait for the quiet period
+    for (int i = 0; i < 3; i++)
+        writer.submit(flushPath, snapshot(i), false, written);
+    CHECK(writer.flush(flushPath));
+    CHECK(writer.writes() == 2);
+    CHECK(writer.coalesced() == 11);
+    CHECK(readFile(flushPath) == snapshot(2));
+
+    // once stopped every save is written on the caller
+    writer.stop();
+    writer.submit(burstPath, snapshot(10), false, written);
+    CHECK(writer.writes() == 3);
+    CHECK(writer.coalesced() == 11);
+    CHECK(readFile(burstPath) == snapshot(10));
+    CHECK(callbacks == 3);
+
+    unlink(burstPath.c_str());
+    unlink(flushPath.c_str());
+    rmdir(dir);
+
+    printf("{\"writes\":%llu,\"coalesced\":%llu,\"failures\":%d}\n", static_cast<unsigned long long>(writer.writes()),
+           static_cast<unsigned long long>(writer.coalesced()), failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,129 @@
+/*******************************************************************************
+ Copyright(c) 2019 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+// Decoding cost of one 'q' telemetry frame: the former split() + std::stod path
+// against decodeQFrame(). Prints one JSON object, e.g. for tracking between releases.
+
+#include "astrolink4_protocol.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <regex>
+#include <string>
+#include <vector>
+
+#include <getopt.h>
+
+namespace
+{
+
+typedef std::chrono::steady_clock Clock;
+
+const char *FRAME = "q:1234:0:1.47:1:2.12:45.1:-12.81:1:-25.22:45:0:0:0:1:12.1:5.0:1.12:13.41:0:34:0:0";
+
+volatile double sink;
+
+std::vector<std::string> split(const std::string &input, const std::string &regex)
+{
+    // as the driver did before the tokenizer, a new regex per call
+    std::regex re(regex);
+    std::sregex_token_iterator first{input.begin(), input.end(), re, -1}, last;
+    return {first, last};
+}
+
+// the fields and conversions sensorRead() used per frame, repeated ones included
+double legacyDecode(const char *res)
+{
+    std::vector<std::string> result = split(res, ":");
+    double sum = std::stod(result[Q_STEPPER_POS]) + std::stod(result[Q_STEPS_TO_GO]) + std::stod(result[Q_CURRENT]);
+    if(std::stod(result[Q_SENS1_TYPE]) > 0)
+        sum += std::stod(result[Q_SENS1_TEMP]) + std::stod(result[Q_SENS1_HUM]) + std::stod(result[Q_SENS1_DEW]);
+    if(std::stod(result[Q_SENS2_TYPE]) > 0)
+        sum += std::stod(result[Q_SENS2_TEMP]);
+    sum += std::stod(result[Q_PWM1]) + std::stod(result[Q_PWM2]) + std::stod(result[Q_DC_MOVE]);
+    const int outs[] = { Q_OUT1, Q_OUT2, Q_OUT3 };
+    for(int out : outs)
+        sum += (std::stod(result[out]) > 0) + (std::stod(result[out]) == 0);
+    sum += std::stod(result[Q_COMP_DIFF]) + std::stod(result[Q_VIN]) + std::stod(result[Q_VREG]);
+    sum += std::stod(result[Q_AH]) + std::stod(result[Q_WH]) + std::stod(result[Q_OP_VALUE]);
+    return sum;
+}
+
+double typedDecode(const char *res)
+{
+    Astrolink4::QFrame frame;
+    if(!Astrolink4::decodeQFrame(res, frame))
+        return 0;
+    double sum = frame.stepperPos + frame.stepsToGo + frame.current;
+    if(frame.sens1Type > 0)
+        sum += frame.sens1Temp + frame.sens1Hum + frame.sens1Dew;
+    if(frame.sens2Type > 0)
+        sum += frame.sens2Temp;
+    sum += frame.pwm1 + frame.pwm2 + frame.dcMove;
+    const bool outs[] = { frame.out1, frame.out2, frame.out3 };
+    for(bool out : outs)
+        sum += out + !out;
+    sum += frame.compDiff + frame.vin + frame.vreg + frame.ah + frame.wh + frame.opValue;
+    return sum;
+}
+
+template <class Decode>
+double nsPerFrame(Decode decode, long iterations)
+{
+    // warm up caches and the allocator first
+    for(long i = 0; i < iterations / 10 + 1; i++)
+        sink = decode(FRAME);
+    Clock::time_point start = Clock::now();
+    for(long i = 0; i < iterations; i++)
+        sink = decode(FRAME);
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / iterations;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    long iterations = 200000;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': iterations = atol(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-n iterations]\n", argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if(iterations <= 0)
+        iterations = 1;
+
+    if(std::fabs(legacyDecode(FRAME) - typedDecode(FRAME)) > 1e-6)
+    {
+        fprintf(stderr, "decoders disagree on the test frame\n");
+        return 1;
+    }
+
+    double legacy = nsPerFrame(legacyDecode, iterations);
+    double typed = nsPerFrame(typedDecode, iterations);
+    printf("{\"benchmark\":\"q_decode\",\"iterations\":%ld,\"split_stod_ns\":%.1f,\"decode_qframe_ns\":%.1f,\"speedup\":%.2f}\n",
+           iterations, legacy, typed, typed > 0 ? legacy / typed : 0.0);
+    return 0;
+}
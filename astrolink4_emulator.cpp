@@ -0,0 +1,374 @@
+/*******************************************************************************
+ Copyright(c) 2019 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+// AstroLink 4 mini firmware emulator on a pseudo terminal.
+// The driver connects to the printed (or linked) device path like to a real port.
+
+#include "astrolink4_protocol.h"
+
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace
+{
+
+typedef std::chrono::steady_clock Clock;
+
+volatile sig_atomic_t running = 1;
+
+void onSignal(int)
+{
+    running = 0;
+}
+
+std::vector<std::string> fields(const char *frame)
+{
+    const char *views[ASTROLINK4_MAX_FIELDS];
+    size_t count = Astrolink4::tokenize(frame, views, ASTROLINK4_MAX_FIELDS);
+    std::vector<std::string> result;
+    for (size_t i = 0; i < count; i++)
+        result.push_back(std::string(views[i], strcspn(views[i], ":")));
+    return result;
+}
+
+std::string join(const std::vector<std::string> &values)
+{
+    std::string result;
+    for (size_t i = 0; i < values.size(); i++)
+        result += (i ? ":" : "") + values[i];
+    return result;
+}
+
+class Device
+{
+public:
+    Device()
+    {
+        u = fields("u:25000:220:0:100:440:0:0:1:257:0:0:0:0:0:1:0:0");
+        e = fields("e:30:1200:1:0:20");
+        n = fields("n:1077:140:100:100");
+        j = fields("j:0");
+        start = last = Clock::now();
+    }
+
+    void update(Clock::time_point now)
+    {
+        double dt = std::chrono::duration<double>(now - last).count();
+        last = now;
+        updateStepper(dt);
+
+        if (dcMoving && now >= dcEnd)
+            dcMoving = false;
+
+        double amps = 0.05 + 0.3 * (out[0] + out[1] + out[2]) + 0.01 * (pwm[0] + pwm[1]) + (std::fabs(velocity) > 0 ? 0.4 : 0);
+        current = amps;
+        ah += amps * dt / 3600.0;
+        wh += amps * vin * dt / 3600.0;
+    }
+
+    std::string handle(const std::string &cmd)
+    {
+        char buf[256];
+        std::vector<std::string> args = fields(cmd.c_str());
+        char c = cmd.empty() ? '\0' : cmd[0];
+        switch (c)
+        {
+            case '#':
+                return "#:AstroLink4mini";
+            case 'q':
+            {
+                double t = std::chrono::duration<double>(last - start).count();
+                double temp = 8.0 + 2.0 * std::sin(t / 600.0);
+                double hum = 70.0 + 5.0 * std::sin(t / 900.0);
+                double dew = temp - (100.0 - hum) / 5.0;
+                snprintf(buf, sizeof(buf), "q:%ld:%ld:%.2f:1:%.2f:%.1f:%.2f:1:%.2f:%d:%d:%d:%d:%d:%.1f:%.1f:%.2f:%.2f:%d:%d:0:0",
+                         lround(position), target - lround(position), current, temp, hum, dew, temp - 0.7,
+                         pwm[0], pwm[1], out[0], out[1], out[2], vin, 5.0, ah, wh, dcMoving ? 1 : 0, 0);
+                return buf;
+            }
+            case 'p':
+                snprintf(buf, sizeof(buf), "p:%ld", lround(position));
+                return buf;
+            case 'i':
+                return "i:0";
+            case 'f':
+                return manual ? "f:1" : "f:0";
+            case 'u':
+                return join(u);
+            case 'e':
+                return join(e);
+            case 'n':
+                return join(n);
+            case 'j':
+                return join(j);
+            case 'U':
+                return store(u, args, "U:");
+            case 'E':
+                return store(e, args, "E:");
+            case 'N':
+                return store(n, args, "N:");
+            case 'J':
+                return store(j, args, "J:");
+            case 'R':
+                if (args.size() > 2)
+                {
+                    long max = atol(u[U_MAX_POS].c_str());
+                    target = std::max(0L, std::min(max, atol(args[2].c_str())));
+                }
+                return "R:";
+            case 'P':
+                if (args.size() > 2)
+                    position = target = atol(args[2].c_str());
+                velocity = 0;
+                return "P:";
+            case 'H':
+                // stop at the current step, the real firmware stops without ramp down
+                target = lround(position);
+                position = target;
+                velocity = 0;
+                return "H:";
+            case 'S':
+                if (args.size() > 1)
+                    target = lround(position) + atol(args[1].c_str());
+                return "S:";
+            case 'C':
+                if (args.size() > 2)
+                {
+                    int index = atoi(args[1].c_str());
+                    if (index >= 0 && index < 3)
+                        out[index] = atoi(args[2].c_str()) > 0;
+                }
+                return "C:";
+            case 'B':
+                if (args.size() > 2)
+                {
+                    int index = atoi(args[1].c_str());
+                    int value = atoi(args[2].c_str());
+                    // 255 selects automatic dew control, emulated as a fixed duty
+                    if (index >= 0 && index < 2)
+                        pwm[index] = value > 100 ? 40 : value;
+                }
+                return "B:";
+            case 'G':
+                if (args.size() > 3)
+                {
+                    dcMoving = true;
+                    dcEnd = last + std::chrono::milliseconds(atol(args[3].c_str()));
+                }
+                return "G:";
+            case 'K':
+                dcMoving = false;
+                return "K:";
+            case 'F':
+                if (args.size() > 1)
+                    manual = atoi(args[1].c_str()) > 0;
+                return "F:";
+            default:
+                return "";
+        }
+    }
+
+private:
+    static std::string store(std::vector<std::string> &frame, const std::vector<std::string> &args, const char *ack)
+    {
+        // trailing ':' in set commands yields an empty last field
+        size_t count = args.size();
+        while (count > 1 && args[count - 1].empty())
+            count--;
+        for (size_t i = 1; i < count && i < frame.size(); i++)
+            frame[i] = args[i];
+        return ack;
+    }
+
+    void updateStepper(double dt)
+    {
+        double distance = target - position;
+        if (std::fabs(distance) < 0.5 && std::fabs(velocity) < 1)
+        {
+            position = target;
+            velocity = 0;
+            return;
+        }
+
+        double speed = std::max(1.0, atof(u[U_SPEED].c_str()));
+        double acc = std::max(1.0, atof(u[U_ACC].c_str()));
+        double direction = distance > 0 ? 1 : -1;
+        double v = std::fabs(velocity);
+        // trapezoidal profile, brake when the remaining distance equals the stopping distance
+        if (v * v / (2 * acc) >= std::fabs(distance))
+            v = std::max(0.0, v - acc * dt);
+        else
+            v = std::min(speed, v + acc * dt);
+        velocity = direction * std::max(v, 1.0);
+
+        double step = velocity * dt;
+        if (std::fabs(step) >= std::fabs(distance))
+        {
+            position = target;
+            velocity = 0;
+        }
+        else
+            position += step;
+    }
+
+    std::vector<std::string> u, e, n, j;
+    Clock::time_point start, last;
+    double position { 1000 };
+    long target { 1000 };
+    double velocity { 0 };
+    bool dcMoving { false };
+    Clock::time_point dcEnd;
+    int out[3] { 0, 0, 0 };
+    int pwm[2] { 0, 0 };
+    bool manual { true };
+    double vin { 12.1 };
+    double current { 0 };
+    double ah { 0 };
+    double wh { 0 };
+};
+
+void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-l link] [-d latency_ms] [-j jitter_ms]\n"
+            "  -l  create a symbolic link to the pseudo terminal, e.g. /tmp/ttyAstroLink4\n"
+            "  -d  delay before each reply [ms]\n"
+            "  -j  additional random delay up to this value [ms]\n", name);
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    const char *link = nullptr;
+    int latencyMs = 0, jitterMs = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "l:d:j:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'l': link = optarg; break;
+            case 'd': latencyMs = atoi(optarg); break;
+            case 'j': jitterMs = atoi(optarg); break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+    {
+        perror("posix_openpt");
+        return 1;
+    }
+    const char *slaveName = ptsname(master);
+
+    // keep the slave side open so the master does not see hangups between driver connections
+    int slave = open(slaveName, O_RDWR | O_NOCTTY);
+    struct termios tio;
+    if (slave < 0 || tcgetattr(slave, &tio) != 0)
+    {
+        perror(slaveName);
+        return 1;
+    }
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+
+    if (link)
+    {
+        unlink(link);
+        if (symlink(slaveName, link) != 0)
+        {
+            perror(link);
+            return 1;
+        }
+    }
+    printf("AstroLink 4 mini emulator on %s\n", link ? link : slaveName);
+    fflush(stdout);
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    Device device;
+    std::string input;
+    std::deque<std::pair<Clock::time_point, std::string>> replies;
+
+    while (running)
+    {
+        struct pollfd pfd = { master, POLLIN, 0 };
+        int rc = poll(&pfd, 1, 5);
+        Clock::time_point now = Clock::now();
+        device.update(now);
+
+        if (rc > 0 && (pfd.revents & POLLIN))
+        {
+            char buf[256];
+            ssize_t count = read(master, buf, sizeof(buf));
+            for (ssize_t i = 0; i < count; i++)
+            {
+                if (buf[i] == '\r')
+                    continue;
+                if (buf[i] != '\n')
+                {
+                    input += buf[i];
+                    continue;
+                }
+
+                std::string reply = device.handle(input);
+                input.clear();
+                if (reply.empty())
+                    continue;
+
+                // replies leave in order, a pipelined burst is answered one after another
+                int delay = latencyMs + (jitterMs > 0 ? rand() % (jitterMs + 1) : 0);
+                Clock::time_point due = now + std::chrono::milliseconds(delay);
+                if (!replies.empty() && due < replies.back().first)
+                    due = replies.back().first;
+                replies.push_back(std::make_pair(due, reply + "\n"));
+            }
+        }
+
+        while (!replies.empty() && replies.front().first <= now)
+        {
+            const std::string &reply = replies.front().second;
+            if (write(master, reply.data(), reply.size()) < 0 && errno != EAGAIN)
+                perror("write");
+            replies.pop_front();
+        }
+    }
+
+    if (link)
+        unlink(link);
+    close(slave);
+    close(master);
+    return 0;
+}
@@ -0,0 +1,199 @@
+/*******************************************************************************
+ Copyright(c) 2019 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include "astrolink4_history.h"
+#include "astrolink4_protocol.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace Astrolink4
+{
+
+namespace
+{
+
+const uint16_t BINARY_VERSION = 1;
+const uint16_t BINARY_RECORD_SIZE = 8 + 4 + 7 * 4 + 4;
+
+uint8_t toByte(double value)
+{
+    return static_cast<uint8_t>(std::max(0.0, std::min(255.0, std::round(value))));
+}
+
+void putLE(std::vector<char> &out, uint64_t value, size_t bytes)
+{
+    for (size_t i = 0; i < bytes; i++)
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+}
+
+void putFloat(std::vector<char> &out, float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    putLE(out, bits, 4);
+}
+
+}
+
+TelemetrySample TelemetrySample::fromFrame(const QFrame &frame, uint64_t timeMs)
+{
+    TelemetrySample sample;
+    sample.timeMs = timeMs;
+    sample.position = frame.stepperPos;
+    sample.current = frame.current;
+    if (frame.stepsToGo != 0 || frame.dcMove)
+        sample.flags |= MOVING;
+    if (!frame.isFull())
+        return sample;
+
+    sample.flags |= FULL_FRAME;
+    sample.vin = frame.vin;
+    sample.vreg = frame.vreg;
+    if (frame.sens1Type > 0)
+    {
+        sample.flags |= SENSOR1;
+        sample.sens1Temp = frame.sens1Temp;
+        sample.sens1Hum = frame.sens1Hum;
+        sample.sens1Dew = frame.sens1Dew;
+    }
+    if (frame.sens2Type > 0)
+    {
+        sample.flags |= SENSOR2;
+        sample.sens2Temp = frame.sens2Temp;
+    }
+    sample.pwm1 = toByte(frame.pwm1);
+    sample.pwm2 = toByte(frame.pwm2);
+    sample.outputs = (frame.out1 ? 1 : 0) | (frame.out2 ? 2 : 0) | (frame.out3 ? 4 : 0);
+    return sample;
+}
+
+TelemetryHistory::TelemetryHistory(size_t capacity) : capacity(capacity)
+{
+}
+
+void TelemetryHistory::allocate()
+{
+    if (!slots)
+        slots.reset(new Slot[capacity]);
+}
+
+void TelemetryHistory::append(const TelemetrySample &sample)
+{
+    if (!slots)
+        return;
+    uint64_t index = written.load(std::memory_order_relaxed);
+    Slot &slot = slots[index % capacity];
+    slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.sample = sample;
+    slot.sequence.store(2 * (index + 1), std::memory_order_release);
+    written.store(index + 1, std::memory_order_release);
+}
+
+std::vector<TelemetrySample> TelemetryHistory::snapshot(uint64_t sinceMs) const
+{
+    std::vector<TelemetrySample> result;
+    uint64_t end = written.load(std::memory_order_acquire);
+    if (end == 0)
+        return result;
+    uint64_t begin = end > capacity ? end - capacity : 0;
+    result.reserve(end - begin);
+    for (uint64_t index = begin; index < end; index++)
+    {
+        const Slot &slot = slots[index % capacity];
+        if (slot.sequence.load(std::memory_order_acquire) != 2 * (index + 1))
+            continue;
+        TelemetrySample sample = slot.sample;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        // the writer lapped the reader while copying
+        if (slot.sequence.load(std::memory_order_relaxed) != 2 * (index + 1))
+            continue;
+        if (sample.timeMs >= sinceMs)
+            result.push_back(sample);
+    }
+    return result;
+}
+
+size_t TelemetryHistory::size() const
+{
+    return std::min<uint64_t>(written.load(std::memory_order_acquire), capacity);
+}
+
+void TelemetryHistory::formatCsv(const std::vector<TelemetrySample> &samples, std::vector<char> &out)
+{
+    static const char header[] =
+        "time,position,current,vin,vreg,sens1_temp,sens1_hum,sens1_dew,sens2_temp,pwm1,pwm2,out1,out2,out3,moving\n";
+    out.assign(header, header + sizeof(header) - 1);
+    char line[256];
+    for (const TelemetrySample &s : samples)
+    {
+        int len = snprintf(line, sizeof(line), "%llu.%03u,%d,%.2f,",
+                           static_cast<unsigned long long>(s.timeMs / 1000), static_cast<unsigned>(s.timeMs % 1000),
+                           s.position, s.current);
+        if (s.flags & TelemetrySample::FULL_FRAME)
+            len += snprintf(line + len, sizeof(line) - len, "%.2f,%.2f,", s.vin, s.vreg);
+        else
+            len += snprintf(line + len, sizeof(line) - len, ",,");
+        if (s.flags & TelemetrySample::SENSOR1)
+            len += snprintf(line + len, sizeof(line) - len, "%.2f,%.2f,%.2f,", s.sens1Temp, s.sens1Hum, s.sens1Dew);
+        else
+            len += snprintf(line + len, sizeof(line) - len, ",,,");
+        if (s.flags & TelemetrySample::SENSOR2)
+            len += snprintf(line + len, sizeof(line) - len, "%.2f,", s.sens2Temp);
+        else
+            len += snprintf(line + len, sizeof(line) - len, ",");
+        if (s.flags & TelemetrySample::FULL_FRAME)
+            len += snprintf(line + len, sizeof(line) - len, "%u,%u,%u,%u,%u,", s.pwm1, s.pwm2,
+                            s.outputs & 1, (s.outputs >> 1) & 1, (s.outputs >> 2) & 1);
+        else
+            len += snprintf(line + len, sizeof(line) - len, ",,,,,");
+        len += snprintf(line + len, sizeof(line) - len, "%u\n", (s.flags & TelemetrySample::MOVING) ? 1 : 0);
+        out.insert(out.end(), line, line + len);
+    }
+}
+
+void TelemetryHistory::formatBinary(const std::vector<TelemetrySample> &samples, std::vector<char> &out)
+{
+    out.clear();
+    out.reserve(12 + samples.size() * BINARY_RECORD_SIZE);
+    out.insert(out.end(), { 'A', 'L', '4', 'T' });
+    putLE(out, BINARY_VERSION, 2);
+    putLE(out, BINARY_RECORD_SIZE, 2);
+    putLE(out, samples.size(), 4);
+    for (const TelemetrySample &s : samples)
+    {
+        putLE(out, s.timeMs, 8);
+        putLE(out, static_cast<uint32_t>(s.position), 4);
+        putFloat(out, s.current);
+        putFloat(out, s.vin);
+        putFloat(out, s.vreg);
+        putFloat(out, s.sens1Temp);
+        putFloat(out, s.sens1Hum);
+        putFloat(out, s.sens1Dew);
+        putFloat(out, s.sens2Temp);
+        out.push_back(static_cast<char>(s.pwm1));
+        out.push_back(static_cast<char>(s.pwm2));
+        out.push_back(static_cast<char>(s.outputs));
+        out.push_back(static_cast<char>(s.flags));
+    }
+}
+
+}
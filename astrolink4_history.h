@@ -0,0 +1,102 @@
+/*******************************************************************************
+ Copyright(c) 2019 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef ASTROLINK4_HISTORY_H
+#define ASTROLINK4_HISTORY_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#define ASTROLINK4_HISTORY_SIZE	16384
+
+namespace Astrolink4
+{
+
+struct QFrame;
+
+// Compact telemetry sample taken from one 'q' frame
+struct TelemetrySample
+{
+    enum Flags
+    {
+        FULL_FRAME = 1,
+        SENSOR1 = 2,
+        SENSOR2 = 4,
+        MOVING = 8
+    };
+
+    // milliseconds since the Unix epoch
+    uint64_t timeMs { 0 };
+    int32_t position { 0 };
+    float current { 0 };
+    float vin { 0 };
+    float vreg { 0 };
+    float sens1Temp { 0 };
+    float sens1Hum { 0 };
+    float sens1Dew { 0 };
+    float sens2Temp { 0 };
+    uint8_t pwm1 { 0 };
+    uint8_t pwm2 { 0 };
+    // bit 0..2 for outputs 1..3
+    uint8_t outputs { 0 };
+    uint8_t flags { 0 };
+
+    static TelemetrySample fromFrame(const QFrame &frame, uint64_t timeMs);
+};
+
+// Fixed capacity history of telemetry samples, allocated once by allocate()
+// so units never connected do not hold it. One thread appends, any thread may read without locking: every slot carries
+// a sequence number and readers skip slots rewritten while they were copied.
+class TelemetryHistory
+{
+public:
+    explicit TelemetryHistory(size_t capacity = ASTROLINK4_HISTORY_SIZE);
+
+    // before the writer starts, later calls keep the samples
+    void allocate();
+
+    // writer side, never allocates, dropped until allocate()
+    void append(const TelemetrySample &sample);
+
+    // copies samples not older than sinceMs, oldest first
+    std::vector<TelemetrySample> snapshot(uint64_t sinceMs) const;
+    size_t size() const;
+
+    static void formatCsv(const std::vector<TelemetrySample> &samples, std::vector<char> &out);
+    // little endian records after a "AL4T" header with version, record size and count
+    static void formatBinary(const std::vector<TelemetrySample> &samples, std::vector<char> &out);
+
+private:
+    struct Slot
+    {
+        // odd while written, 2 * (index + 1) once sample index is stored
+        std::atomic<uint64_t> sequence { 0 };
+        TelemetrySample sample;
+    };
+
+    size_t capacity;
+    std::unique_ptr<Slot[]> slots;
+    std::atomic<uint64_t> written { 0 };
+};
+
+}
+
+#endif
@@ -0,0 +1,368 @@
+/*******************************************************************************
+ Copyright(c) 2019 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+// End-to-end request latency: drives the driver through its ISNew* entry points
+// against astrolink4_emulator with a scripted reply delay and times each request
+// from the call to the property reported Ok, as a client sees it on the wire.
+// Prints one JSON object with p50/p95/p99 per request type.
+
+#include <indidevapi.h>
+#include <eventloop.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define BENCH_DEVICE    "AstroLink 4"
+// a request not confirmed within this time counts as failed [ms]
+#define BENCH_TIMEOUT   30000
+// idle time after each connect, the first polls settle [ms]
+#define BENCH_SETTLE    1000
+
+namespace
+{
+
+typedef std::chrono::steady_clock Clock;
+
+// property state changes as the driver wrote them to stdout
+struct Event
+{
+    std::string name;
+    std::string state;
+};
+
+std::mutex eventLock;
+std::vector<Event> events;
+
+std::string attribute(const std::string &tag, const char *key)
+{
+    std::string pattern = std::string(key) + "=\"";
+    size_t start = tag.find(pattern);
+    if (start == std::string::npos)
+        return "";
+    start += pattern.size();
+    size_t end = tag.find('"', start);
+    return end == std::string::npos ? "" : tag.substr(start, end - start);
+}
+
+// the driver stdout, only the opening tags of vector definitions and updates matter
+void collect(int fd)
+{
+    std::string stream;
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+    {
+        stream.append(buf, n);
+        size_t pos = 0;
+        for (;;)
+        {
+            size_t open = stream.find('<', pos);
+            if (open == std::string::npos)
+            {
+                pos = stream.size();
+                break;
+            }
+            size_t close = stream.find('>', open);
+            if (close == std::string::npos)
+            {
+                pos = open;
+                break;
+            }
+            std::string tag = stream.substr(open, close - open);
+            if (tag.compare(0, 4, "<set") == 0 || tag.compare(0, 4, "<def") == 0)
+            {
+                std::string state = attribute(tag, "state");
+                if (!state.empty())
+                {
+                    std::lock_guard<std::mutex> lock(eventLock);
+                    events.push_back({ attribute(tag, "name"), state });
+                }
+            }
+            pos = close + 1;
+        }
+        stream.erase(0, pos);
+    }
+}
+
+struct Category
+{
+    const char *name;
+    std::vector<double> samples;
+    int failures;
+
+    explicit Category(const char *name) : name(name), failures(0) {}
+};
+
+struct Step
+{
+    Category *category;
+    // Ok only counts after Busy, an earlier confirmation can still be in the pipe
+    const char *property;
+    bool needsBusy;
+    std::function<void()> issue;
+    int waitMs;
+};
+
+std::vector<Step> steps;
+size_t current = 0;
+bool issued = false;
+size_t seen = 0;
+bool busySeen = false;
+Clock::time_point issuedAt;
+FILE *report = nullptr;
+int latencyMs = 20, jitterMs = 0, requests = 20;
+pid_t emulator = -1;
+std::vector<Category *> categories;
+
+void newSwitch(const char *name, const char *on, const char *off)
+{
+    ISState states[] = { ISS_ON, ISS_OFF };
+    char *names[] = { const_cast<char *>(on), const_cast<char *>(off) };
+    ISNewSwitch(BENCH_DEVICE, name, states, names, 2);
+}
+
+double percentile(std::vector<double> samples, double fraction)
+{
+    if (samples.empty())
+        return 0;
+    std::sort(samples.begin(), samples.end());
+    size_t rank = static_cast<size_t>(std::ceil(fraction * samples.size()));
+    return samples[std::max<size_t>(rank, 1) - 1];
+}
+
+void finish(int code)
+{
+    fprintf(report, "{\"benchmark\":\"request_latency\",\"latency_ms\":%d,\"jitter_ms\":%d,\"iterations\":%d",
+            latencyMs, jitterMs, requests);
+    for (const Category *category : categories)
+    {
+        const std::vector<double> &s = category->samples;
+        fprintf(report, ",\"%s\":{\"count\":%u,\"failures\":%d,\"p50_ms\":%.2f,\"p95_ms\":%.2f,\"p99_ms\":%.2f,\"max_ms\":%.2f}",
+                category->name, static_cast<unsigned>(s.size()), category->failures, percentile(s, 0.50),
+                percentile(s, 0.95), percentile(s, 0.99), s.empty() ? 0.0 : *std::max_element(s.begin(), s.end()));
+    }
+    fprintf(report, "}\n");
+    fflush(report);
+    if (emulator > 0)
+    {
+        kill(emulator, SIGTERM);
+        waitpid(emulator, nullptr, 0);
+    }
+    exit(code);
+}
+
+// runs on the INDI event loop, so the driver timers keep firing between checks
+void tick(void *)
+{
+    if (current >= steps.size())
+        finish(0);
+
+    Step &step = steps[current];
+    if (!issued)
+    {
+        {
+            std::lock_guard<std::mutex> lock(eventLock);
+            seen = events.size();
+        }
+        busySeen = !step.needsBusy;
+        issuedAt = Clock::now();
+        issued = true;
+        if (step.issue)
+            step.issue();
+    }
+
+    double elapsed = std::chrono::duration<double, std::milli>(Clock::now() - issuedAt).count();
+    bool done = false;
+    if (step.property == nullptr)
+        done = elapsed >= step.waitMs;
+    else
+    {
+        std::lock_guard<std::mutex> lock(eventLock);
+        for (; seen < events.size() && !done; seen++)
+        {
+            if (events[seen].name != step.property)
+                continue;
+            const std::string &state = events[seen].state;
+            if (state == "Busy")
+                busySeen = true;
+            else if (state == "Ok" && busySeen)
+            {
+                step.category->samples.push_back(elapsed);
+                done = true;
+            }
+            else if (state == "Alert")
+            {
+                step.category->failures++;
+                done = true;
+            }
+        }
+        if (!done && elapsed > BENCH_TIMEOUT)
+        {
+            step.category->failures++;
+            done = true;
+        }
+    }
+
+    if (done)
+    {
+        current++;
+        issued = false;
+    }
+    IEAddTimer(1, tick, nullptr);
+}
+
+void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-e emulator] [-d latency_ms] [-j jitter_ms] [-n requests] [-c connects]\n"
+            "  -e  path of astrolink4_emulator, by default next to this program\n"
+            "  -d  emulator delay before each reply [ms]\n"
+            "  -j  emulator additional random delay up to this value [ms]\n"
+            "  -n  requests per type\n"
+            "  -c  connect cycles\n", name);
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    std::string emulatorPath;
+    const char *self = strrchr(argv[0], '/');
+    emulatorPath = self ? std::string(argv[0], self - argv[0] + 1) + "astrolink4_emulator" : "./astrolink4_emulator";
+    int connects = 3;
+    int opt;
+    while ((opt = getopt(argc, argv, "e:d:j:n:c:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'e': emulatorPath = optarg; break;
+            case 'd': latencyMs = atoi(optarg); break;
+            case 'j': jitterMs = atoi(optarg); break;
+            case 'n': requests = std::max(1, atoi(optarg)); break;
+            case 'c': connects = std::max(1, atoi(optarg)); break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    // configuration, state cache and archive go to a scratch home, not the real one
+    char home[] = "/tmp/astrolink4_bench_XXXXXX";
+    if (mkdtemp(home) == nullptr)
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    setenv("HOME", home, 1);
+    unsetenv("INDICONFIG");
+    std::string link = std::string(home) + "/tty";
+
+    emulator = fork();
+    if (emulator == 0)
+    {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        std::string delay = std::to_string(latencyMs), jitter = std::to_string(jitterMs);
+        execl(emulatorPath.c_str(), emulatorPath.c_str(), "-l", link.c_str(), "-d", delay.c_str(), "-j", jitter.c_str(),
+              static_cast<char *>(nullptr));
+        perror(emulatorPath.c_str());
+        _exit(1);
+    }
+    struct stat st;
+    for (int i = 0; i < 500 && lstat(link.c_str(), &st) != 0; i++)
+        usleep(10000);
+    if (lstat(link.c_str(), &st) != 0)
+    {
+        fprintf(stderr, "emulator did not start: %s\n", emulatorPath.c_str());
+        return 1;
+    }
+
+    // the driver talks XML on stdout, the report keeps the original stdout
+    report = fdopen(dup(STDOUT_FILENO), "w");
+    int pipeFds[2];
+    if (report == nullptr || pipe(pipeFds) != 0 || dup2(pipeFds[1], STDOUT_FILENO) < 0)
+    {
+        perror("pipe");
+        return 1;
+    }
+    close(pipeFds[1]);
+    std::thread(collect, pipeFds[0]).detach();
+
+    static Category connect("connect"), move("move"), power("power"), settings("settings");
+    categories = { &connect, &move, &power, &settings };
+
+    ISGetProperties(nullptr);
+    static std::vector<char> port(link.begin(), link.end());
+    port.push_back('\0');
+    char *texts[] = { port.data() };
+    char *textNames[] = { const_cast<char *>("PORT") };
+    ISNewText(BENCH_DEVICE, "DEVICE_PORT", texts, textNames, 1);
+
+    for (int i = 0; i < connects; i++)
+    {
+        steps.push_back({ &connect, "CONNECTION", false, []() { newSwitch("CONNECTION", "CONNECT", "DISCONNECT"); }, 0 });
+        steps.push_back({ nullptr, nullptr, false, nullptr, BENCH_SETTLE });
+        if (i + 1 < connects)
+            steps.push_back({ nullptr, nullptr, false, []() { newSwitch("CONNECTION", "DISCONNECT", "CONNECT"); }, BENCH_SETTLE });
+    }
+    for (int i = 0; i < requests; i++)
+    {
+        // short moves back and forth, the time includes the motion itself
+        double target = 1000 + (i % 2 ? 0 : 50);
+        steps.push_back({ &move, "ABS_FOCUS_POSITION", true, [target]()
+        {
+            double values[] = { target };
+            char *names[] = { const_cast<char *>("FOCUS_ABSOLUTE_POSITION") };
+            ISNewNumber(BENCH_DEVICE, "ABS_FOCUS_POSITION", values, names, 1);
+        }, 0 });
+        bool on = i % 2 == 0;
+        steps.push_back({ &power, "DC1", true, [on]()
+        {
+            newSwitch("DC1", on ? "PWR1BTN_ON" : "PWR1BTN_OFF", on ? "PWR1BTN_OFF" : "PWR1BTN_ON");
+        }, 0 });
+        double speed = i % 2 ? 250 : 300;
+        steps.push_back({ &settings, "FOCUSER_SETTINGS", true, [speed]()
+        {
+            double values[] = { speed, 5.0, 0, 10 };
+            char *names[] = { const_cast<char *>("FS_SPEED"), const_cast<char *>("FS_STEP_SIZE"),
+                              const_cast<char *>("FS_COMPENSATION"), const_cast<char *>("FS_COMP_THRESHOLD") };
+            ISNewNumber(BENCH_DEVICE, "FOCUSER_SETTINGS", values, names, 4);
+        }, 0 });
+    }
+    steps.push_back({ nullptr, nullptr, false, []() { newSwitch("CONNECTION", "DISCONNECT", "CONNECT"); }, BENCH_SETTLE });
+
+    IEAddTimer(1, tick, nullptr);
+    eventLoop();
+    return 0;
+}
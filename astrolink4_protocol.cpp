@@ -0,0 +1,184 @@
+/*******************************************************************************
+ Copyright(c) 2019 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+#include "astrolink4_protocol.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace Astrolink4
+{
+
+size_t tokenize(const char *frame, const char *fields[], size_t maxFields)
+{
+    size_t count = 0;
+    if (frame == nullptr || maxFields == 0)
+        return 0;
+
+    fields[count++] = frame;
+    for (const char *p = frame; *p != '\0' && *p != '\n' && *p != '\r'; ++p)
+    {
+        if (*p == ':')
+        {
+            if (count == maxFields)
+                break;
+            fields[count++] = p + 1;
+        }
+    }
+    return count;
+}
+
+// numeric fields end at the ':' separator, strtod/strtol stop there without copying
+static double toDouble(const char *field)
+{
+    return strtod(field, nullptr);
+}
+
+static int32_t toInt(const char *field)
+{
+    return static_cast<int32_t>(strtol(field, nullptr, 10));
+}
+
+bool decodeQFrame(const char *res, QFrame &frame)
+{
+    const char *fields[ASTROLINK4_MAX_FIELDS];
+    size_t count = tokenize(res, fields, ASTROLINK4_MAX_FIELDS);
+    if (count <= Q_CURRENT || res[0] != 'q')
+        return false;
+
+    frame.fieldCount = count;
+    for (size_t i = 1; i < count; i++)
+    {
+        const char *field = fields[i];
+        switch (i)
+        {
+            case Q_STEPPER_POS: frame.stepperPos = toInt(field); break;
+            case Q_STEPS_TO_GO: frame.stepsToGo = toInt(field); break;
+            case Q_CURRENT:     frame.current = toDouble(field); break;
+            case Q_SENS1_TYPE:  frame.sens1Type = toInt(field); break;
+            case Q_SENS1_TEMP:  frame.sens1Temp = toDouble(field); break;
+            case Q_SENS1_HUM:   frame.sens1Hum = toDouble(field); break;
+            case Q_SENS1_DEW:   frame.sens1Dew = toDouble(field); break;
+            case Q_SENS2_TYPE:  frame.sens2Type = toInt(field); break;
+            case Q_SENS2_TEMP:  frame.sens2Temp = toDouble(field); break;
+            case Q_PWM1:        frame.pwm1 = toDouble(field); break;
+            case Q_PWM2:        frame.pwm2 = toDouble(field); break;
+            case Q_OUT1:        frame.out1 = toDouble(field) > 0; break;
+            case Q_OUT2:        frame.out2 = toDouble(field) > 0; break;
+            case Q_OUT3:        frame.out3 = toDouble(field) > 0; break;
+            case Q_VIN:         frame.vin = toDouble(field); break;
+            case Q_VREG:        frame.vreg = toDouble(field); break;
+            case Q_AH:          frame.ah = toDouble(field); break;
+            case Q_WH:          frame.wh = toDouble(field); break;
+            case Q_DC_MOVE:     frame.dcMove = toDouble(field) > 0; break;
+            case Q_COMP_DIFF:   frame.compDiff = toDouble(field); break;
+            case Q_OP_FLAG:     frame.opFlag = toInt(field); break;
+            case Q_OP_VALUE:    frame.opValue = toDouble(field); break;
+            default: break;
+        }
+    }
+    return true;
+}
+
+bool decodePFrame(const char *res, int32_t &position)
+{
+    // only the fields tokenize() reports are set, the rest stays null
+    const char *fields[P_STEPPER_POS + 1] = { nullptr };
+    size_t count = tokenize(res, fields, P_STEPPER_POS + 1);
+    if (count != P_STEPPER_POS + 1 || res[0] != 'p' || fields[P_STEPPER_POS] == nullptr)
+        return false;
+    position = toInt(fields[P_STEPPER_POS]);
+    return true;
+}
+
+
+bool FrameText::parse(const char *reply, char command, size_t minFields)
+{
+    const char *fields[ASTROLINK4_MAX_FIELDS];
+    size_t len = strcspn(reply, "\r\n");
+    if (reply[0] != command || reply[1] != ':' || len >= ASTROLINK4_FRAME_LEN)
+        return false;
+
+    memcpy(text, reply, len);
+    text[len] = '\0';
+    size_t fieldCount = tokenize(text, fields, ASTROLINK4_MAX_FIELDS);
+    for (size_t i = 0; i < fieldCount; i++)
+    {
+        offsets[i] = static_cast<uint8_t>(fields[i] - text);
+        lengths[i] = static_cast<uint8_t>(strcspn(fields[i], ":"));
+    }
+    // a trailing separator is not a field
+    while (fieldCount > 1 && lengths[fieldCount - 1] == 0)
+        fieldCount--;
+    pending = 0;
+    count = fieldCount >= minFields ? fieldCount : 0;
+    return count > 0;
+}
+
+double FrameText::raw(size_t index) const
+{
+    return index < count ? toDouble(text + offsets[index]) : 0;
+}
+
+void FrameText::setRaw(size_t index, long value)
+{
+    if (index == 0 || index >= count)
+        return;
+    values[index] = value;
+    pending |= 1u << index;
+}
+
+size_t FrameText::render(char command, char *out, size_t size) const
+{
+    size_t len = 0;
+    if (size < 2)
+        return 0;
+    out[len++] = command;
+    for (size_t i = 1; i < count; i++)
+    {
+        int written = (pending & (1u << i))
+                      ? snprintf(out + len, size - len, ":%ld", values[i])
+                      : snprintf(out + len, size - len, ":%.*s", static_cast<int>(lengths[i]), text + offsets[i]);
+        if (written < 0 || static_cast<size_t>(written) >= size - len)
+            return 0;
+        len += written;
+    }
+    out[len] = '\0';
+    return len;
+}
+
+size_t FrameText::encode(char setCommand, char *out, size_t size) const
+{
+    size_t len = render(setCommand, out, size);
+    if (len == 0 || len + 1 >= size)
+        return 0;
+    out[len++] = ':';
+    out[len] = '\0';
+    return len;
+}
+
+bool FrameText::commit(char getCommand)
+{
+    char frame[ASTROLINK4_FRAME_LEN];
+    size_t fieldCount = count;
+    if (render(getCommand, frame, sizeof(frame)) == 0)
+        return false;
+    return parse(frame, getCommand, fieldCount);
+}
+
+}
@@ -0,0 +1,368 @@
+/*******************************************************************************
+ Copyright(c) 2019 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef ASTROLINK4_PROTOCOL_H
+#define ASTROLINK4_PROTOCOL_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#define Q_STEPPER_POS		1
+#define Q_STEPS_TO_GO		2
+#define Q_CURRENT			3
+#define Q_SENS1_TYPE		4
+#define Q_SENS1_TEMP		5
+#define Q_SENS1_HUM			6
+#define Q_SENS1_DEW			7
+#define Q_SENS2_TYPE		8
+#define Q_SENS2_TEMP		9
+#define Q_PWM1				10
+#define Q_PWM2				11
+#define Q_OUT1				12
+#define Q_OUT2				13
+#define Q_OUT3				14
+#define Q_VIN				15
+#define Q_VREG				16
+#define Q_AH				17
+#define Q_WH				18
+#define Q_DC_MOVE			19
+#define Q_COMP_DIFF			20
+#define Q_OP_FLAG			21
+#define Q_OP_VALUE			22
+
+#define P_STEPPER_POS		1
+
+#define U_MAX_POS			1
+#define U_SPEED				2
+#define U_PWMSTOP			3
+#define U_PWMRUN			4
+#define U_ACC				5
+#define U_REVERSED			6
+#define U_STEPPER_MODE		7
+#define U_COMPSENS			8
+#define U_STEPSIZE			9
+#define U_PWMPRESC			10
+#define U_STEPPRESC			11
+#define U_BUZ_ENABLED		12
+#define U_HUM_SENS			13
+#define U_DC_REVERSED		14
+#define U_OUT1_DEF			15
+#define U_OUT2_DEF			16
+#define U_OUT3_DEF			17
+
+#define E_COMP_CYCLE		1
+#define E_COMP_STEPS		2
+#define E_COMP_SENSR		3
+#define E_COMP_AUTO			4
+#define E_COMP_TRGR			5
+
+#define N_AREF_COEFF		1
+#define N_OVER_VOLT			2
+#define N_OVER_AMP			3
+#define N_OVER_TIME			4
+
+#define ASTROLINK4_MAX_FIELDS	32
+
+namespace Astrolink4
+{
+
+// Splits a ':' separated reply into views pointing into the reply buffer itself.
+// Nothing is copied or allocated, each view ends at the next ':' or at the end of the reply.
+size_t tokenize(const char *frame, const char *fields[], size_t maxFields);
+
+// Decoded 'q' telemetry frame
+struct QFrame
+{
+    size_t fieldCount { 0 };
+
+    int32_t stepperPos { 0 };
+    int32_t stepsToGo { 0 };
+    double current { 0 };
+
+    int sens1Type { 0 };
+    double sens1Temp { 0 };
+    double sens1Hum { 0 };
+    double sens1Dew { 0 };
+    int sens2Type { 0 };
+    double sens2Temp { 0 };
+
+    double pwm1 { 0 };
+    double pwm2 { 0 };
+    bool out1 { false };
+    bool out2 { false };
+    bool out3 { false };
+
+    double vin { 0 };
+    double vreg { 0 };
+    double ah { 0 };
+    double wh { 0 };
+
+    bool dcMove { false };
+    double compDiff { 0 };
+    int opFlag { 0 };
+    double opValue { 0 };
+
+    // short frames carry only position, steps to go and current
+    bool isFull() const
+    {
+        return fieldCount > Q_SENS1_TYPE + 1;
+    }
+};
+
+// Single pass decoder of the 'q' reply, returns false when the reply is not a 'q' frame
+bool decodeQFrame(const char *res, QFrame &frame);
+
+// Decoder of the short 'p' reply carrying only the stepper position
+bool decodePFrame(const char *res, int32_t &position);
+
+#define ASTROLINK4_FRAME_LEN	100
+
+// Settings frame kept as received. Fields can be replaced before sending it
+// back, the fields not replaced go out exactly as the device reported them.
+class FrameText
+{
+public:
+    // keeps the reply when it belongs to the command and has at least minFields fields
+    bool parse(const char *reply, char command, size_t minFields);
+    bool isValid() const
+    {
+        return count > 0;
+    }
+    void invalidate()
+    {
+        count = 0;
+        pending = 0;
+    }
+    const char *str() const
+    {
+        return text;
+    }
+    double raw(size_t index) const;
+    void setRaw(size_t index, long value);
+
+    // set command with the pending changes and the trailing separator, returns its length or 0
+    size_t encode(char setCommand, char *out, size_t size) const;
+    // the device confirmed the set command, the pending changes become the frame
+    bool commit(char getCommand);
+    void discard()
+    {
+        pending = 0;
+    }
+
+private:
+    size_t render(char command, char *out, size_t size) const;
+
+    char text[ASTROLINK4_FRAME_LEN] {};
+    uint8_t offsets[ASTROLINK4_MAX_FIELDS] {};
+    uint8_t lengths[ASTROLINK4_MAX_FIELDS] {};
+    size_t count { 0 };
+    uint32_t pending { 0 };
+    long values[ASTROLINK4_MAX_FIELDS] {};
+};
+
+// Type and scale of each settings field, one specialization per frame and index below.
+// A field without an entry in the table does not compile.
+template <class Frame, int Index>
+struct FieldTraits;
+
+// One field of a settings frame: its index, its type in the driver and the
+// factor between the device value and the property value (device = value * Scale).
+// Type and scale must match the frame's entry in FieldTraits.
+template <class Frame, int Index, class T = long, int Scale = 1>
+struct Field
+{
+    static_assert(std::is_same<T, typename FieldTraits<Frame, Index>::type>::value, "type differs from the field table");
+    static_assert(Scale == FieldTraits<Frame, Index>::scale, "scale differs from the field table");
+    static_assert(Index > 0, "field 0 is the command letter");
+    static_assert(Index < ASTROLINK4_MAX_FIELDS, "field index beyond the decoder limit");
+    static_assert(Scale > 0, "scale must be positive");
+    static_assert(!std::is_same<T, bool>::value || Scale == 1, "flags are never scaled");
+    static_assert(!std::is_integral<T>::value || std::is_same<T, bool>::value || Scale == 1,
+                  "scaled fields must be decoded as double");
+
+    typedef Frame frame;
+    typedef T type;
+    static const int index = Index;
+    static const int scale = Scale;
+
+    static T decode(double raw)
+    {
+        return static_cast<T>(raw / Scale);
+    }
+    static long encode(T value)
+    {
+        return std::lround(static_cast<double>(value) * Scale);
+    }
+};
+
+template <char Get, char Set, int Fields>
+class SettingsFrame : public FrameText
+{
+public:
+    static const char GET = Get;
+    static const char SET = Set;
+    static const int FIELDS = Fields;
+
+    bool parse(const char *reply)
+    {
+        return FrameText::parse(reply, Get, Fields);
+    }
+    size_t encode(char *out, size_t size) const
+    {
+        return FrameText::encode(Set, out, size);
+    }
+    bool commit()
+    {
+        return FrameText::commit(Get);
+    }
+
+    template <class F>
+    typename F::type get() const
+    {
+        check<F>();
+        return F::decode(raw(F::index));
+    }
+
+    template <class F>
+    static void check()
+    {
+        static_assert(std::is_same<typename F::frame, SettingsFrame>::value, "field belongs to another frame");
+        static_assert(F::index < Fields, "field outside the frame");
+    }
+};
+
+// Changes to one frame, built where the request arrives and applied to the shadow copy later
+template <class Frame>
+class SettingsPatch
+{
+public:
+    template <class F>
+    SettingsPatch &set(typename F::type value)
+    {
+        Frame::template check<F>();
+        mask |= 1u << F::index;
+        values[F::index] = F::encode(value);
+        return *this;
+    }
+
+    void applyTo(Frame &frame) const
+    {
+        for (int i = 1; i < Frame::FIELDS; i++)
+            if (mask & (1u << i))
+                frame.setRaw(i, values[i]);
+    }
+
+private:
+    uint32_t mask { 0 };
+    long values[Frame::FIELDS] {};
+};
+
+typedef SettingsFrame<'u', 'U', U_OUT3_DEF + 1> UFrame;
+typedef SettingsFrame<'e', 'E', E_COMP_TRGR + 1> EFrame;
+typedef SettingsFrame<'n', 'N', N_OVER_TIME + 1> NFrame;
+typedef SettingsFrame<'j', 'J', 2> JFrame;
+// read only here, manual mode is set with a plain F command
+typedef SettingsFrame<'f', 'F', 2> FFrame;
+
+#define ASTROLINK4_FIELD(Frame, Index, T, Scale) \
+    template <> struct FieldTraits<Frame, Index> \
+    { \
+        static_assert(Index < Frame::FIELDS, "field outside the frame"); \
+        typedef T type; \
+        static const int scale = Scale; \
+    }
+
+// device value = property value * scale
+ASTROLINK4_FIELD(UFrame, U_MAX_POS, long, 1);
+ASTROLINK4_FIELD(UFrame, U_SPEED, double, 1);
+ASTROLINK4_FIELD(UFrame, U_ACC, double, 1);
+ASTROLINK4_FIELD(UFrame, U_REVERSED, bool, 1);
+ASTROLINK4_FIELD(UFrame, U_STEPPER_MODE, long, 1);
+ASTROLINK4_FIELD(UFrame, U_STEPSIZE, double, 100);
+ASTROLINK4_FIELD(UFrame, U_OUT1_DEF, bool, 1);
+ASTROLINK4_FIELD(UFrame, U_OUT2_DEF, bool, 1);
+ASTROLINK4_FIELD(UFrame, U_OUT3_DEF, bool, 1);
+
+ASTROLINK4_FIELD(EFrame, E_COMP_CYCLE, long, 1);
+ASTROLINK4_FIELD(EFrame, E_COMP_STEPS, double, 100);
+ASTROLINK4_FIELD(EFrame, E_COMP_SENSR, long, 1);
+ASTROLINK4_FIELD(EFrame, E_COMP_AUTO, bool, 1);
+ASTROLINK4_FIELD(EFrame, E_COMP_TRGR, double, 1);
+
+ASTROLINK4_FIELD(NFrame, N_AREF_COEFF, double, 1000);
+ASTROLINK4_FIELD(NFrame, N_OVER_VOLT, double, 10);
+ASTROLINK4_FIELD(NFrame, N_OVER_AMP, double, 10);
+ASTROLINK4_FIELD(NFrame, N_OVER_TIME, double, 1);
+
+ASTROLINK4_FIELD(JFrame, 1, bool, 1);
+ASTROLINK4_FIELD(FFrame, 1, bool, 1);
+
+#undef ASTROLINK4_FIELD
+
+namespace UField
+{
+typedef Field<UFrame, U_MAX_POS> MaxPos;
+typedef Field<UFrame, U_SPEED, double> Speed;
+typedef Field<UFrame, U_ACC, double> Acceleration;
+typedef Field<UFrame, U_REVERSED, bool> Reversed;
+typedef Field<UFrame, U_STEPPER_MODE> StepperMode;
+// [um]
+typedef Field<UFrame, U_STEPSIZE, double, 100> StepSize;
+typedef Field<UFrame, U_OUT1_DEF, bool> Out1Default;
+typedef Field<UFrame, U_OUT2_DEF, bool> Out2Default;
+typedef Field<UFrame, U_OUT3_DEF, bool> Out3Default;
+}
+
+namespace EField
+{
+// [s]
+typedef Field<EFrame, E_COMP_CYCLE> Cycle;
+// [steps/C]
+typedef Field<EFrame, E_COMP_STEPS, double, 100> Steps;
+typedef Field<EFrame, E_COMP_SENSR> Sensor;
+typedef Field<EFrame, E_COMP_AUTO, bool> Auto;
+// [C]
+typedef Field<EFrame, E_COMP_TRGR, double> Trigger;
+}
+
+namespace NField
+{
+typedef Field<NFrame, N_AREF_COEFF, double, 1000> ArefCoeff;
+// [V]
+typedef Field<NFrame, N_OVER_VOLT, double, 10> OverVolt;
+// [A]
+typedef Field<NFrame, N_OVER_AMP, double, 10> OverAmp;
+// [s]
+typedef Field<NFrame, N_OVER_TIME, double> OverTime;
+}
+
+namespace JField
+{
+typedef Field<JFrame, 1, bool> Buzzer;
+}
+
+namespace FField
+{
+typedef Field<FFrame, 1, bool> Manual;
+}
+
+}
+
+#endif
@@ -0,0 +1,137 @@
+/*******************************************************************************
+ Copyright(c) 2019 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include "astrolink4_reactor.h"
+#include "astrolink4_reader.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#define REACTOR_EVENTS	16
+
+namespace Astrolink4
+{
+
+SerialReactor::~SerialReactor()
+{
+    if (thread.joinable())
+    {
+        uint64_t one = 1;
+        if (write(wakeFd, &one, sizeof(one)) == sizeof(one))
+            thread.join();
+        else
+            thread.detach();
+    }
+    if (epollFd >= 0)
+        close(epollFd);
+    if (wakeFd >= 0)
+        close(wakeFd);
+}
+
+bool SerialReactor::startLocked()
+{
+    if (thread.joinable())
+        return true;
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (epollFd < 0 || wakeFd < 0)
+        return false;
+
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = wakeFd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event) != 0)
+        return false;
+
+    thread = std::thread(&SerialReactor::run, this);
+    return true;
+}
+
+bool SerialReactor::add(int fd, LineReader *reader)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!startLocked())
+        return false;
+
+    struct epoll_event event = {};
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.fd = fd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) != 0)
+    {
+        if (errno != EEXIST || epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event) != 0)
+            return false;
+    }
+    readers[fd] = reader;
+    return true;
+}
+
+void SerialReactor::remove(int fd)
+{
+    std::lock_guard<std::mutex> dispatch(dispatchMutex);
+    std::lock_guard<std::mutex> lock(mutex);
+    if (readers.erase(fd) > 0 && epollFd >= 0)
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+void SerialReactor::run()
+{
+    struct epoll_event events[REACTOR_EVENTS];
+    for (;;)
+    {
+        int count = epoll_wait(epollFd, events, REACTOR_EVENTS, -1);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+
+        std::lock_guard<std::mutex> dispatch(dispatchMutex);
+        for (int i = 0; i < count; i++)
+        {
+            int fd = events[i].data.fd;
+            if (fd == wakeFd)
+                return;
+
+            LineReader *reader = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                std::map<int, LineReader *>::iterator it = readers.find(fd);
+                if (it != readers.end())
+                    reader = it->second;
+            }
+            // a port removed while we were waiting
+            if (reader == nullptr)
+                continue;
+
+            bool hangup = (events[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) != 0;
+            if (!reader->onReadable(hangup))
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                readers.erase(fd);
+                epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+            }
+        }
+    }
+}
+
+}
@@ -0,0 +1,62 @@
+/*******************************************************************************
+ Copyright(c) 2019 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef ASTROLINK4_REACTOR_H
+#define ASTROLINK4_REACTOR_H
+
+#include <map>
+#include <mutex>
+#include <thread>
+
+namespace Astrolink4
+{
+
+class LineReader;
+
+// One epoll thread receiving on the serial ports of all units in the process.
+// Incoming bytes are moved into the reader of the port and its waiting worker
+// is woken, the reactor itself never blocks on a single device.
+class SerialReactor
+{
+public:
+    SerialReactor() = default;
+    ~SerialReactor();
+
+    SerialReactor(const SerialReactor &) = delete;
+    SerialReactor &operator=(const SerialReactor &) = delete;
+
+    bool add(int fd, LineReader *reader);
+    // returns when no callback for the port is running any more
+    void remove(int fd);
+
+private:
+    bool startLocked();
+    void run();
+
+    std::mutex mutex;
+    // serialises dispatching with remove()
+    std::mutex dispatchMutex;
+    std::thread thread;
+    std::map<int, LineReader *> readers;
+    int epollFd { -1 };
+    int wakeFd { -1 };
+};
+
+}
+
+#endif
@@ -0,0 +1,275 @@
+/*******************************************************************************
+ Copyright(c) 2019 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+#include "astrolink4_reader.h"
+#include "astrolink4_reactor.h"
+
+#include <cerrno>
+#include <chrono>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#define RING_MASK (ASTROLINK4_RING_SIZE - 1)
+
+static_assert((ASTROLINK4_RING_SIZE & RING_MASK) == 0, "ring size must be a power of two");
+
+namespace Astrolink4
+{
+
+LineReader::LineReader(char stopChar) : stopChar(stopChar)
+{
+}
+
+void LineReader::attach(int fd, SerialReactor *reactor)
+{
+    std::lock_guard<std::mutex> writing(writeLock);
+    release();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->fd = fd;
+        failed = false;
+        clear();
+    }
+    if (fd >= 0 && reactor != nullptr)
+    {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        if (reactor->add(fd, this))
+            this->reactor = reactor;
+    }
+}
+
+void LineReader::detach()
+{
+    // waits for a write in progress, no writer sees the descriptor once it may be closed
+    std::lock_guard<std::mutex> writing(writeLock);
+    release();
+}
+
+void LineReader::release()
+{
+    if (reactor != nullptr)
+        reactor->remove(fd);
+    std::lock_guard<std::mutex> lock(mutex);
+    reactor = nullptr;
+    fd = -1;
+}
+
+void LineReader::reset()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    clear();
+}
+
+void LineReader::clear()
+{
+    head = tail = scanned = 0;
+}
+
+bool LineReader::extractLine(char *line, size_t size)
+{
+    while (scanned < used())
+    {
+        if (ring[(head + scanned) & RING_MASK] != stopChar)
+        {
+            scanned++;
+            continue;
+        }
+
+        size_t len = scanned;
+        bool valid = len < size;
+        size_t out = 0;
+        for (size_t i = 0; i < len; i++)
+        {
+            char c = ring[(head + i) & RING_MASK];
+            if (c == '\r')
+                continue;
+            if (c < 0x20 || c > 0x7e)
+                valid = false;
+            else if (valid)
+                line[out++] = c;
+        }
+        head += len + 1;
+        scanned = 0;
+
+        if (!valid)
+        {
+            counters.garbageBytes += len + 1;
+            continue;
+        }
+        line[out] = '\0';
+        counters.lines++;
+        return true;
+    }
+
+    // no stop character in a full buffer, drop it and resync on the next one
+    if (used() == ASTROLINK4_RING_SIZE)
+    {
+        counters.overflows++;
+        counters.garbageBytes += used();
+        clear();
+    }
+    return false;
+}
+
+int LineReader::fill(std::unique_lock<std::mutex> &lock, int timeoutMs)
+{
+    if (fd < 0 || failed)
+        return -1;
+
+    if (reactor != nullptr)
+    {
+        counters.pollCalls++;
+        size_t before = tail;
+        arrived.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this, before]()
+        {
+            return failed || tail != before;
+        });
+        return failed ? -1 : static_cast<int>(tail - before);
+    }
+
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    counters.pollCalls++;
+    int rc = poll(&pfd, 1, timeoutMs);
+    if (rc < 0)
+        return errno == EINTR ? 0 : -1;
+    if (rc == 0)
+        return 0;
+    if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))
+        return -1;
+
+    ssize_t n = receive();
+    if (n < 0)
+        return (errno == EINTR || errno == EAGAIN) ? 0 : -1;
+    if (n == 0)
+        return -1;
+    return static_cast<int>(n);
+}
+
+ssize_t LineReader::receive()
+{
+    // read straight into the free part of the ring, up to the wrap point
+    size_t start = tail & RING_MASK;
+    size_t space = ASTROLINK4_RING_SIZE - used();
+    size_t chunk = ASTROLINK4_RING_SIZE - start;
+    if (chunk > space)
+        chunk = space;
+
+    counters.readCalls++;
+    ssize_t n = read(fd, ring + start, chunk);
+    if (n > 0)
+    {
+        tail += n;
+        counters.bytesIn += n;
+    }
+    return n;
+}
+
+bool LineReader::onReadable(bool hangup)
+{
+    bool alive;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (;;)
+        {
+            // nobody consumes a full ring, drop it rather than stop reading the port
+            if (used() == ASTROLINK4_RING_SIZE)
+            {
+                counters.overflows++;
+                counters.garbageBytes += used();
+                clear();
+            }
+            ssize_t n = receive();
+            if (n > 0)
+                continue;
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n == 0 || errno != EAGAIN || hangup)
+                failed = true;
+            break;
+        }
+        alive = !failed;
+    }
+    arrived.notify_all();
+    return alive;
+}
+
+LineReader::Result LineReader::readLine(char *line, size_t size, int timeoutMs)
+{
+    using namespace std::chrono;
+    steady_clock::time_point deadline = steady_clock::now() + milliseconds(timeoutMs);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;)
+    {
+        if (extractLine(line, size))
+            return LINE;
+
+        int remaining = static_cast<int>(duration_cast<milliseconds>(deadline - steady_clock::now()).count());
+        if (remaining <= 0)
+            return TIMEOUT;
+        if (fill(lock, remaining) < 0)
+            return FAILURE;
+    }
+}
+
+bool LineReader::pendingLine(char *line, size_t size)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if (extractLine(line, size))
+        return true;
+    // with a reactor everything received is already in the ring
+    return reactor == nullptr && fill(lock, 0) > 0 && extractLine(line, size);
+}
+
+bool LineReader::writeAll(const char *data, size_t len, const std::atomic<uint32_t> *generation, uint32_t expected)
+{
+    std::lock_guard<std::mutex> lock(writeLock);
+    if (fd < 0)
+    {
+        errno = EBADF;
+        return false;
+    }
+    // an abort bumps the generation before its own write, a stale command must not follow it
+    if (generation != nullptr && generation->load() != expected)
+    {
+        errno = ECANCELED;
+        return false;
+    }
+
+    while (len > 0)
+    {
+        counters.writeCalls++;
+        ssize_t n = write(fd, data, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            // non blocking port with a full output queue
+            struct pollfd pfd = { fd, POLLOUT, 0 };
+            if (errno == EAGAIN && poll(&pfd, 1, 100) >= 0)
+                continue;
+            return false;
+        }
+        data += n;
+        len -= n;
+        counters.bytesOut += n;
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,118 @@
+/*******************************************************************************
+ Copyright(c) 2019 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef ASTROLINK4_READER_H
+#define ASTROLINK4_READER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <sys/types.h>
+
+#define ASTROLINK4_RING_SIZE	1024
+
+namespace Astrolink4
+{
+
+class SerialReactor;
+
+// Persistent receive buffer on the serial port.
+// The byte stream is split on the stop character, nothing is flushed, lines
+// with non printable content are dropped until the next stop character.
+// Attached to a reactor the port is non blocking and the reactor thread fills
+// the buffer, the reading thread only waits for it.
+class LineReader
+{
+public:
+    enum Result
+    {
+        LINE,
+        TIMEOUT,
+        FAILURE
+    };
+
+    struct Stats
+    {
+        uint64_t readCalls { 0 };
+        uint64_t pollCalls { 0 };
+        uint64_t writeCalls { 0 };
+        uint64_t bytesIn { 0 };
+        uint64_t bytesOut { 0 };
+        uint64_t lines { 0 };
+        uint64_t garbageBytes { 0 };
+        uint64_t overflows { 0 };
+    };
+
+    explicit LineReader(char stopChar = '\n');
+
+    void attach(int fd, SerialReactor *reactor = nullptr);
+    void detach();
+    void reset();
+
+    // waits up to timeoutMs for a complete line, the stop character is not copied
+    Result readLine(char *line, size_t size, int timeoutMs);
+    // returns a line already received without blocking
+    bool pendingLine(char *line, size_t size);
+    // safe from any thread, concurrent writes never interleave on the wire.
+    // With a generation the data is dropped, errno ECANCELED, once it no longer equals expected.
+    bool writeAll(const char *data, size_t len, const std::atomic<uint32_t> *generation = nullptr, uint32_t expected = 0);
+
+    // reactor thread only, returns false once the port failed
+    bool onReadable(bool hangup);
+
+    const Stats &stats() const
+    {
+        return counters;
+    }
+
+private:
+    // writeLock held
+    void release();
+    bool extractLine(char *line, size_t size);
+    int fill(std::unique_lock<std::mutex> &lock, int timeoutMs);
+    // reads what the port has into the ring, up to the wrap point
+    ssize_t receive();
+    void clear();
+    size_t used() const
+    {
+        return tail - head;
+    }
+
+    int fd { -1 };
+    SerialReactor *reactor { nullptr };
+    // guards the ring against the reactor thread
+    std::mutex mutex;
+    std::condition_variable arrived;
+    // serializes writers and guards fd, the abort path writes outside the worker
+    std::mutex writeLock;
+    bool failed { false };
+    char stopChar;
+    char ring[ASTROLINK4_RING_SIZE];
+    // free running indices, masked on access
+    size_t head { 0 };
+    size_t tail { 0 };
+    // bytes already searched for the stop character
+    size_t scanned { 0 };
+    Stats counters;
+};
+
+}
+
+#endif
@@ -0,0 +1,230 @@
+/*******************************************************************************
+ Copyright(c) 2019 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+// System calls per poll cycle on a pseudo terminal: the former per command
+// tcflush() + byte wise tty_nread_section() path against the pipelined LineReader.
+// Prints one JSON object, e.g. for tracking between releases.
+
+#include "astrolink4_reader.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/select.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define BENCH_LEN       100
+#define BENCH_TIMEOUT   3
+
+namespace
+{
+
+std::atomic<bool> running { true };
+
+// canned firmware replies, the content does not matter for the call count
+const char *reply(char command)
+{
+    switch (command)
+    {
+        case 'q': return "q:1234:0:1.47:1:2.12:45.1:-12.81:1:-25.22:45:0:0:0:1:12.1:5.0:1.12:13.41:0:34:0:0";
+        case 'u': return "u:25000:220:0:100:440:0:0:1:257:0:0:0:0:0:1:0:0";
+        case 'e': return "e:30:1200:1:0:20";
+        case 'n': return "n:1077:140:100:100";
+        case 'j': return "j:0";
+        case 'f': return "f:1";
+        default: return nullptr;
+    }
+}
+
+void respond(int master)
+{
+    std::string input;
+    while (running)
+    {
+        fd_set set;
+        FD_ZERO(&set);
+        FD_SET(master, &set);
+        struct timeval tv = { 0, 10000 };
+        if (select(master + 1, &set, nullptr, nullptr, &tv) <= 0)
+            continue;
+        char buf[256];
+        ssize_t count = read(master, buf, sizeof(buf));
+        for (ssize_t i = 0; i < count; i++)
+        {
+            if (buf[i] != '\n')
+            {
+                input += buf[i];
+                continue;
+            }
+            if (const char *line = reply(input.empty() ? '\0' : input[0]))
+            {
+                std::string out = std::string(line) + "\n";
+                if (write(master, out.data(), out.size()) < 0)
+                    perror("write");
+            }
+            input.clear();
+        }
+    }
+}
+
+struct Calls
+{
+    uint64_t tcflush { 0 };
+    uint64_t write { 0 };
+    uint64_t select { 0 };
+    uint64_t read { 0 };
+
+    uint64_t total() const
+    {
+        return tcflush + write + select + read;
+    }
+};
+
+// the driver before the framed reader: flush, write, then one select() and one read() per byte
+bool legacyCommand(int fd, const char *cmd, char *res, Calls &calls)
+{
+    char command[BENCH_LEN];
+    snprintf(command, BENCH_LEN, "%s\n", cmd);
+    calls.tcflush++;
+    tcflush(fd, TCIOFLUSH);
+    calls.write++;
+    if (write(fd, command, strlen(command)) < 0)
+        return false;
+
+    int n = 0;
+    for (;;)
+    {
+        fd_set set;
+        FD_ZERO(&set);
+        FD_SET(fd, &set);
+        struct timeval tv = { BENCH_TIMEOUT, 0 };
+        calls.select++;
+        if (select(fd + 1, &set, nullptr, nullptr, &tv) <= 0)
+            return false;
+        calls.read++;
+        if (read(fd, res + n, 1) != 1)
+            return false;
+        if (res[n++] == '\n' || n == BENCH_LEN - 1)
+            break;
+    }
+    res[n - 1] = '\0';
+    calls.tcflush++;
+    tcflush(fd, TCIOFLUSH);
+    return cmd[0] == res[0];
+}
+
+// the current driver: all commands in one write, replies split from the receive ring
+bool readerCycle(Astrolink4::LineReader &reader, const char *const cmds[], size_t count)
+{
+    std::string burst;
+    for (size_t i = 0; i < count; i++)
+        burst += std::string(cmds[i]) + "\n";
+    if (!reader.writeAll(burst.data(), burst.size()))
+        return false;
+    char line[BENCH_LEN];
+    for (size_t i = 0; i < count; i++)
+        if (reader.readLine(line, BENCH_LEN, BENCH_TIMEOUT * 1000) != Astrolink4::LineReader::LINE || line[0] != cmds[i][0])
+            return false;
+    return true;
+}
+
+bool measure(int fd, const char *name, const char *const cmds[], size_t count, int cycles, bool comma)
+{
+    Calls calls;
+    char res[BENCH_LEN];
+    for (int c = 0; c < cycles; c++)
+        for (size_t i = 0; i < count; i++)
+            if (!legacyCommand(fd, cmds[i], res, calls))
+                return false;
+
+    Astrolink4::LineReader reader;
+    reader.attach(fd);
+    for (int c = 0; c < cycles; c++)
+        if (!readerCycle(reader, cmds, count))
+            return false;
+    const Astrolink4::LineReader::Stats &stats = reader.stats();
+    uint64_t readerCalls = stats.writeCalls + stats.pollCalls + stats.readCalls;
+    reader.detach();
+
+    printf("%s\"%s\":{\"commands\":%u,\"legacy_syscalls\":%.1f,\"legacy_tcflush\":%.1f,\"legacy_write\":%.1f,\"legacy_select\":%.1f,"
+           "\"legacy_read\":%.1f,\"reader_syscalls\":%.1f,\"reader_write\":%.1f,\"reader_poll\":%.1f,\"reader_read\":%.1f}",
+           comma ? "," : "", name, static_cast<unsigned>(count),
+           double(calls.total()) / cycles, double(calls.tcflush) / cycles, double(calls.write) / cycles, double(calls.select) / cycles,
+           double(calls.read) / cycles, double(readerCalls) / cycles, double(stats.writeCalls) / cycles,
+           double(stats.pollCalls) / cycles, double(stats.readCalls) / cycles);
+    return true;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    int cycles = 200;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': cycles = atoi(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-n cycles]\n", argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (cycles <= 0)
+        cycles = 1;
+
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+    {
+        perror("posix_openpt");
+        return 1;
+    }
+    int fd = open(ptsname(master), O_RDWR | O_NOCTTY);
+    struct termios tio;
+    if (fd < 0 || tcgetattr(fd, &tio) != 0)
+    {
+        perror("ptsname");
+        return 1;
+    }
+    cfmakeraw(&tio);
+    tcsetattr(fd, TCSANOW, &tio);
+    std::thread responder(respond, master);
+
+    const char *idle[] = { "q" };
+    const char *refresh[] = { "q", "u", "j", "e", "f", "n" };
+    printf("{\"benchmark\":\"poll_syscalls\",\"cycles\":%d,", cycles);
+    bool ok = measure(fd, "idle_poll", idle, 1, cycles, false) &&
+              measure(fd, "full_refresh", refresh, 6, cycles, true);
+    printf("}\n");
+
+    running = false;
+    responder.join();
+    close(fd);
+    close(master);
+    if (!ok)
+        fprintf(stderr, "a command got no valid reply\n");
+    return ok ? 0 : 1;
+}
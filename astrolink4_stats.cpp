@@ -0,0 +1,63 @@
+/*******************************************************************************
+ Copyright(c) 2019 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+#include "astrolink4_stats.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Astrolink4
+{
+
+LatencyHistogram::LatencyHistogram()
+{
+    reset();
+}
+
+void LatencyHistogram::reset()
+{
+    std::fill(buckets, buckets + BUCKETS, 0);
+    total = 0;
+    maxMs = 0;
+}
+
+void LatencyHistogram::record(double ms)
+{
+    double us = std::max(1.0, ms * 1000.0);
+    int index = std::min(BUCKETS - 1, static_cast<int>(std::floor(4.0 * std::log2(us))));
+    buckets[index]++;
+    total++;
+    maxMs = std::max(maxMs, ms);
+}
+
+double LatencyHistogram::percentile(double fraction) const
+{
+    if (total == 0)
+        return 0;
+
+    uint64_t rank = static_cast<uint64_t>(std::ceil(fraction * total));
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++)
+    {
+        seen += buckets[i];
+        if (seen >= rank && seen > 0)
+            return std::min(maxMs, std::pow(2.0, (i + 1) / 4.0) / 1000.0);
+    }
+    return maxMs;
+}
+
+}
@@ -0,0 +1,57 @@
+/*******************************************************************************
+ Copyright(c) 2019 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef ASTROLINK4_STATS_H
+#define ASTROLINK4_STATS_H
+
+#include <cstdint>
+
+namespace Astrolink4
+{
+
+// Fixed size histogram with four buckets per octave of microseconds,
+// percentiles are accurate to about 19%, recording never allocates.
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    void record(double ms);
+    void reset();
+
+    // upper bound of the bucket holding the given fraction of samples, in ms
+    double percentile(double fraction) const;
+    uint64_t count() const
+    {
+        return total;
+    }
+    double max() const
+    {
+        return maxMs;
+    }
+
+private:
+    static const int BUCKETS = 128;
+    uint64_t buckets[BUCKETS];
+    uint64_t total;
+    double maxMs;
+};
+
+}
+
+#endif
@@ -0,0 +1,162 @@
+/*******************************************************************************
+ Copyright(c) 2019 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+#include "astrolink4_trace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace Astrolink4
+{
+
+namespace
+{
+
+void writeEscaped(FILE *fp, const char *text, size_t len)
+{
+    for (size_t i = 0; i < len && text[i] != '\0'; i++)
+    {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        if (c == '"' || c == '\\')
+            fprintf(fp, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(fp, "\\u%04x", c);
+        else
+            fputc(c, fp);
+    }
+}
+
+}
+
+Tracer &Tracer::instance()
+{
+    static Tracer tracer;
+    return tracer;
+}
+
+Tracer::Tracer() : epoch(std::chrono::steady_clock::now())
+{
+}
+
+void Tracer::setEnabled(bool enabled)
+{
+    this->enabled.store(enabled, std::memory_order_relaxed);
+}
+
+uint64_t Tracer::now() const
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+Tracer::ThreadBuffer *Tracer::threadBuffer()
+{
+    // registered on the first span of a thread, later spans find it without locking
+    static thread_local ThreadBuffer *buffer = nullptr;
+    if (buffer)
+        return buffer;
+    std::shared_ptr<ThreadBuffer> created = std::make_shared<ThreadBuffer>();
+    created->tid = static_cast<int>(syscall(SYS_gettid));
+    created->events.reset(new TraceEvent[ASTROLINK4_TRACE_EVENTS]);
+    std::lock_guard<std::mutex> lock(registryLock);
+    buffers.push_back(created);
+    buffer = created.get();
+    return buffer;
+}
+
+void Tracer::record(const char *name, const char *category, uint64_t startNs, const char *detail, size_t detailLen)
+{
+    uint64_t endNs = now();
+    ThreadBuffer *buffer = threadBuffer();
+    uint64_t index = buffer->written.load(std::memory_order_relaxed);
+    TraceEvent &event = buffer->events[index % ASTROLINK4_TRACE_EVENTS];
+    event.startNs = startNs;
+    event.durationNs = endNs - startNs;
+    event.name = name;
+    event.category = category;
+    size_t len = detail ? std::min(detailLen, sizeof(event.detail) - 1) : 0;
+    if (len)
+        memcpy(event.detail, detail, len);
+    event.detail[len] = '\0';
+    buffer->written.store(index + 1, std::memory_order_release);
+}
+
+bool Tracer::dump(const char *path)
+{
+    std::vector<std::shared_ptr<ThreadBuffer>> threads;
+    {
+        std::lock_guard<std::mutex> lock(registryLock);
+        threads = buffers;
+    }
+
+    FILE *fp = fopen(path, "w");
+    if (fp == nullptr)
+        return false;
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    int pid = static_cast<int>(getpid());
+    std::vector<TraceEvent> copy(ASTROLINK4_TRACE_EVENTS);
+    for (const std::shared_ptr<ThreadBuffer> &buffer : threads)
+    {
+        uint64_t end = buffer->written.load(std::memory_order_acquire);
+        uint64_t begin = end > ASTROLINK4_TRACE_EVENTS ? end - ASTROLINK4_TRACE_EVENTS : 0;
+        for (uint64_t i = begin; i < end; i++)
+            copy[i - begin] = buffer->events[i % ASTROLINK4_TRACE_EVENTS];
+        // slots the writer reused while they were copied are dropped, including
+        // slot `after` it may be filling right now, which still held event after - N
+        uint64_t after = buffer->written.load(std::memory_order_acquire);
+        uint64_t valid = after + 1 > ASTROLINK4_TRACE_EVENTS ? after + 1 - ASTROLINK4_TRACE_EVENTS : 0;
+        for (uint64_t i = std::max(begin, valid); i < end; i++)
+        {
+            const TraceEvent &event = copy[i - begin];
+            fprintf(fp, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d",
+                    first ? "" : ",\n", event.name, event.category, event.startNs / 1000.0, event.durationNs / 1000.0,
+                    pid, buffer->tid);
+            if (event.detail[0] != '\0')
+            {
+                fprintf(fp, ",\"args\":{\"detail\":\"");
+                writeEscaped(fp, event.detail, sizeof(event.detail));
+                fprintf(fp, "\"}");
+            }
+            fprintf(fp, "}");
+            first = false;
+        }
+    }
+    fprintf(fp, "\n]}\n");
+    return fclose(fp) == 0;
+}
+
+TraceSpan::TraceSpan(const char *name, const char *category, const char *detail, size_t detailLen) :
+    name(name), category(category), detail(detail), detailLen(detailLen), startNs(0), active(Tracer::instance().isEnabled())
+{
+    if (!active)
+        return;
+    if (detail && !detailLen)
+        this->detailLen = strlen(detail);
+    startNs = Tracer::instance().now();
+}
+
+TraceSpan::~TraceSpan()
+{
+    if (active)
+        Tracer::instance().record(name, category, startNs, detail, detailLen);
+}
+
+}
@@ -0,0 +1,107 @@
+/*******************************************************************************
+ Copyright(c) 2019 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef ASTROLINK4_TRACE_H
+#define ASTROLINK4_TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#define ASTROLINK4_TRACE_EVENTS	16384
+#define ASTROLINK4_TRACE_DETAIL	24
+
+namespace Astrolink4
+{
+
+// One completed span. Name and category point to string literals, the detail
+// is copied raw; nothing is formatted until the trace is dumped.
+struct TraceEvent
+{
+    uint64_t startNs;
+    uint64_t durationNs;
+    const char *name;
+    const char *category;
+    char detail[ASTROLINK4_TRACE_DETAIL];
+};
+
+// Process wide span recorder. Every thread writes into its own preallocated
+// ring, readers copy the rings and drop the slots overwritten meanwhile.
+class Tracer
+{
+public:
+    static Tracer &instance();
+
+    void setEnabled(bool enabled);
+    bool isEnabled() const
+    {
+        return enabled.load(std::memory_order_relaxed);
+    }
+    uint64_t now() const;
+
+    void record(const char *name, const char *category, uint64_t startNs, const char *detail, size_t detailLen);
+
+    // Chrome / Perfetto trace event JSON of everything still in the rings
+    bool dump(const char *path);
+
+private:
+    struct ThreadBuffer
+    {
+        int tid { 0 };
+        std::unique_ptr<TraceEvent[]> events;
+        // slots written so far, the writer publishes with a release store
+        std::atomic<uint64_t> written { 0 };
+    };
+
+    Tracer();
+    ThreadBuffer *threadBuffer();
+
+    std::atomic<bool> enabled { false };
+    std::chrono::steady_clock::time_point epoch;
+    std::mutex registryLock;
+    // buffers outlive their threads so a dump still shows them
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+};
+
+// Records the time from construction to destruction as one span,
+// costs a single relaxed load while tracing is disabled.
+class TraceSpan
+{
+public:
+    TraceSpan(const char *name, const char *category, const char *detail = nullptr, size_t detailLen = 0);
+    ~TraceSpan();
+
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+
+private:
+    const char *name;
+    const char *category;
+    const char *detail;
+    size_t detailLen;
+    uint64_t startNs;
+    bool active;
+};
+
+}
+
+#endif
@@ -0,0 +1,273 @@
+/*******************************************************************************
+ Copyright(c) 2019 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+#include "astrolink4_transcript.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace Astrolink4
+{
+
+namespace
+{
+
+void putLe(uint8_t *out, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        out[i] = static_cast<uint8_t>(value >> (8 * i));
+}
+
+uint64_t getLe(const uint8_t *in, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++)
+        value |= static_cast<uint64_t>(in[i]) << (8 * i);
+    return value;
+}
+
+}
+
+TranscriptWriter::~TranscriptWriter()
+{
+    close();
+}
+
+bool TranscriptWriter::open(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (file)
+        fclose(file);
+    file = fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+    uint8_t header[8] = { 'A', 'L', '4', 'S' };
+    putLe(header + 4, ASTROLINK4_TRANSCRIPT_VERSION, 2);
+    fwrite(header, 1, sizeof(header), file);
+    start = std::chrono::steady_clock::now();
+    return true;
+}
+
+void TranscriptWriter::close()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (file)
+        fclose(file);
+    file = nullptr;
+}
+
+bool TranscriptWriter::isOpen() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return file != nullptr;
+}
+
+void TranscriptWriter::record(uint8_t kind, const char *text, size_t len)
+{
+    write(kind, reinterpret_cast<const uint8_t *>(text), std::min<size_t>(len, 255));
+}
+
+void TranscriptWriter::record(uint8_t kind, uint32_t value)
+{
+    uint8_t payload[4];
+    putLe(payload, value, 4);
+    write(kind, payload, sizeof(payload));
+}
+
+void TranscriptWriter::flush()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (file)
+        fflush(file);
+}
+
+void TranscriptWriter::write(uint8_t kind, const uint8_t *payload, size_t len)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!file)
+        return;
+    // stdio buffers the entries of a burst, flush() writes them once it is complete
+    uint8_t head[10];
+    putLe(head, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count(), 8);
+    head[8] = kind;
+    head[9] = static_cast<uint8_t>(len);
+    fwrite(head, 1, sizeof(head), file);
+    fwrite(payload, 1, len, file);
+}
+
+bool loadTranscript(const std::string &path, std::vector<TranscriptEntry> &entries)
+{
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+    uint8_t header[8];
+    bool ok = fread(header, 1, sizeof(header), file) == sizeof(header) && memcmp(header, "AL4S", 4) == 0 &&
+              getLe(header + 4, 2) == ASTROLINK4_TRANSCRIPT_VERSION;
+    entries.clear();
+    uint8_t head[10], payload[255];
+    while (ok && fread(head, 1, sizeof(head), file) == sizeof(head))
+    {
+        size_t len = head[9];
+        // a recording cut short ends with a partial entry, everything before it is kept
+        if (fread(payload, 1, len, file) != len)
+            break;
+        TranscriptEntry entry;
+        entry.timeUs = getLe(head, 8);
+        entry.kind = head[8];
+        if (entry.isEvent())
+            entry.value = len >= 4 ? static_cast<uint32_t>(getLe(payload, 4)) : 0;
+        else
+            entry.text.assign(reinterpret_cast<const char *>(payload), len);
+        entries.push_back(entry);
+    }
+    fclose(file);
+    return ok;
+}
+
+bool TranscriptReplay::start(std::vector<TranscriptEntry> entries, bool realTime)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    this->entries.swap(entries);
+    this->realTime = realTime;
+    eventCursor = ioCursor = replyFirst = replyLast = 0;
+    counters = Stats();
+    started = std::chrono::steady_clock::now();
+    active = true;
+    return true;
+}
+
+void TranscriptReplay::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        active = false;
+    }
+    stopped.notify_all();
+}
+
+bool TranscriptReplay::isActive() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return active;
+}
+
+TranscriptReplay::Stats TranscriptReplay::stats() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return counters;
+}
+
+void TranscriptReplay::waitUntil(uint64_t timeUs, std::unique_lock<std::mutex> &lock)
+{
+    if (!realTime)
+        return;
+    stopped.wait_until(lock, started + std::chrono::microseconds(timeUs), [this]()
+    {
+        return !active;
+    });
+}
+
+bool TranscriptReplay::nextEvent(TranscriptEntry &event)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (active && eventCursor < entries.size() && !entries[eventCursor].isEvent())
+        eventCursor++;
+    if (!active || eventCursor >= entries.size())
+        return false;
+    waitUntil(entries[eventCursor].timeUs, lock);
+    if (!active)
+        return false;
+    event = entries[eventCursor++];
+    counters.events++;
+    return true;
+}
+
+bool TranscriptReplay::write(const char *data, size_t len)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::string burst(data, len);
+    size_t found = entries.size(), seen = 0;
+    for (size_t i = ioCursor; i < entries.size() && seen < ASTROLINK4_REPLAY_WINDOW; i++)
+    {
+        if (entries[i].kind != TranscriptEntry::COMMAND)
+            continue;
+        if (entries[i].text == burst)
+        {
+            found = i;
+            break;
+        }
+        seen++;
+    }
+
+    replyFirst = replyLast = 0;
+    if (found == entries.size())
+    {
+        // answered with a timeout, the transcript stays where it was
+        counters.diverged++;
+        return true;
+    }
+    counters.matched++;
+    counters.skipped += seen;
+    burstTimeUs = entries[found].timeUs;
+    burstAt = std::chrono::steady_clock::now();
+    replyFirst = replyLast = found + 1;
+    while (replyLast < entries.size() && (entries[replyLast].kind == TranscriptEntry::REPLY ||
+                                          entries[replyLast].kind == TranscriptEntry::TIMEOUT ||
+                                          entries[replyLast].kind == TranscriptEntry::FAILURE))
+        replyLast++;
+    ioCursor = replyLast;
+    return true;
+}
+
+LineReader::Result TranscriptReplay::read(char *line, size_t size)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if (replyFirst >= replyLast)
+        return LineReader::TIMEOUT;
+    const TranscriptEntry &entry = entries[replyFirst++];
+    // the recorded delay after the burst, not the absolute time, the driver may run late
+    if (realTime)
+        stopped.wait_until(lock, burstAt + std::chrono::microseconds(entry.timeUs - burstTimeUs), [this]()
+    {
+        return !active;
+    });
+    if (entry.kind == TranscriptEntry::FAILURE)
+        return LineReader::FAILURE;
+    if (entry.kind == TranscriptEntry::TIMEOUT || size == 0)
+        return LineReader::TIMEOUT;
+    size_t len = std::min(entry.text.size(), size - 1);
+    memcpy(line, entry.text.data(), len);
+    line[len] = '\0';
+    return LineReader::LINE;
+}
+
+bool TranscriptReplay::pendingLine(char *line, size_t size)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t i = ioCursor;
+    while (i < entries.size() && entries[i].isEvent())
+        i++;
+    if (i >= entries.size() || entries[i].kind != TranscriptEntry::LATE || size == 0)
+        return false;
+    size_t len = std::min(entries[i].text.size(), size - 1);
+    memcpy(line, entries[i].text.data(), len);
+    line[len] = '\0';
+    ioCursor = i + 1;
+    return true;
+}
+
+}
@@ -0,0 +1,147 @@
+/*******************************************************************************
+ Copyright(c) 2019 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef ASTROLINK4_TRANSCRIPT_H
+#define ASTROLINK4_TRANSCRIPT_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "astrolink4_reader.h"
+
+#define ASTROLINK4_TRANSCRIPT_VERSION	1
+// recorded bursts searched ahead for the one the driver sends during replay
+#define ASTROLINK4_REPLAY_WINDOW	64
+
+namespace Astrolink4
+{
+
+// One entry of a serial transcript. Serial entries carry the text written or
+// received, events carry what made the driver talk to the device.
+struct TranscriptEntry
+{
+    enum Kind
+    {
+        COMMAND = 1,    // one pipelined burst as written
+        REPLY = 2,      // one line received for the burst before
+        TIMEOUT = 3,
+        FAILURE = 4,
+        LATE = 5,       // line received between bursts
+        POLL = 16,      // sensorRead(), payload is the subsystem mask
+        MOVE = 17,      // MoveAbsFocuser(), payload is the target
+        ABORT = 18      // AbortFocuser()
+    };
+
+    // microseconds since the recording started, monotonic
+    uint64_t timeUs { 0 };
+    uint8_t kind { 0 };
+    std::string text;
+    uint32_t value { 0 };
+
+    bool isEvent() const
+    {
+        return kind >= POLL;
+    }
+};
+
+// Appends entries to a binary transcript: "AL4S", version, then per entry
+// a little endian 64 bit time, the kind, the payload length and the payload.
+// Entries may come from any thread.
+class TranscriptWriter
+{
+public:
+    ~TranscriptWriter();
+
+    bool open(const std::string &path);
+    void close();
+    bool isOpen() const;
+
+    void record(uint8_t kind, const char *text, size_t len);
+    void record(uint8_t kind, uint32_t value);
+    // hands the entries so far to the kernel, a crash keeps every completed burst
+    void flush();
+
+private:
+    void write(uint8_t kind, const uint8_t *payload, size_t len);
+
+    mutable std::mutex mutex;
+    FILE *file { nullptr };
+    std::chrono::steady_clock::time_point start;
+};
+
+bool loadTranscript(const std::string &path, std::vector<TranscriptEntry> &entries);
+
+// Plays a transcript back in place of the serial port. The runner takes the
+// recorded events in order, the driver side answers every burst written with
+// the replies recorded for the same burst. In real time mode events and replies
+// keep their recorded timing, otherwise they follow each other without delay.
+class TranscriptReplay
+{
+public:
+    struct Stats
+    {
+        uint64_t events { 0 };
+        uint64_t matched { 0 };
+        // bursts sent during replay but not found in the transcript
+        uint64_t diverged { 0 };
+        // recorded bursts the replay never sent
+        uint64_t skipped { 0 };
+    };
+
+    bool start(std::vector<TranscriptEntry> entries, bool realTime);
+    void stop();
+    bool isActive() const;
+
+    // runner side, false once the transcript ends or the replay stops
+    bool nextEvent(TranscriptEntry &event);
+
+    // driver side, used instead of the serial port while active
+    bool write(const char *data, size_t len);
+    LineReader::Result read(char *line, size_t size);
+    bool pendingLine(char *line, size_t size);
+
+    Stats stats() const;
+
+private:
+    void waitUntil(uint64_t timeUs, std::unique_lock<std::mutex> &lock);
+
+    mutable std::mutex mutex;
+    std::condition_variable stopped;
+    std::vector<TranscriptEntry> entries;
+    bool active { false };
+    bool realTime { false };
+    size_t eventCursor { 0 };
+    size_t ioCursor { 0 };
+    // replies of the burst being answered
+    size_t replyFirst { 0 };
+    size_t replyLast { 0 };
+    uint64_t burstTimeUs { 0 };
+    std::chrono::steady_clock::time_point started;
+    std::chrono::steady_clock::time_point burstAt;
+    Stats counters;
+};
+
+}
+
+#endif
@@ -0,0 +1,125 @@
+/*******************************************************************************
+ Copyright(c) 2019 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+#include "astrolink4_worker.h"
+
+namespace Astrolink4
+{
+
+SerialWorker::~SerialWorker()
+{
+    stop();
+}
+
+void SerialWorker::start()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (running)
+        return;
+    running = true;
+    thread = std::thread(&SerialWorker::run, this);
+}
+
+void SerialWorker::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!running)
+            return;
+        running = false;
+        queue.clear();
+        delayed.clear();
+    }
+    condition.notify_all();
+    if (thread.joinable() && thread.get_id() != std::this_thread::get_id())
+        thread.join();
+    else if (thread.joinable())
+        thread.detach();
+}
+
+bool SerialWorker::post(Task task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!running)
+            return false;
+        queue.push_back(std::move(task));
+    }
+    condition.notify_one();
+    return true;
+}
+
+bool SerialWorker::postAfter(std::chrono::milliseconds delay, Task task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!running)
+            return false;
+        delayed.insert(std::make_pair(Clock::now() + delay, std::move(task)));
+    }
+    condition.notify_one();
+    return true;
+}
+
+bool SerialWorker::isRunning() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return running;
+}
+
+bool SerialWorker::isWorkerThread() const
+{
+    return thread.get_id() == std::this_thread::get_id();
+}
+
+size_t SerialWorker::pending() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return queue.size();
+}
+
+void SerialWorker::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;)
+    {
+        if (!running)
+            return;
+        // delayed jobs join the queue behind whatever was posted before they became due
+        Clock::time_point now = Clock::now();
+        while (!delayed.empty() && delayed.begin()->first <= now)
+        {
+            queue.push_back(std::move(delayed.begin()->second));
+            delayed.erase(delayed.begin());
+        }
+        if (queue.empty())
+        {
+            if (delayed.empty())
+                condition.wait(lock);
+            else
+                condition.wait_until(lock, delayed.begin()->first);
+            continue;
+        }
+        Task task = std::move(queue.front());
+        queue.pop_front();
+        lock.unlock();
+        task();
+        lock.lock();
+    }
+}
+
+}
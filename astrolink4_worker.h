@@ -0,0 +1,73 @@
+/*******************************************************************************
+ Copyright(c) 2019 astrojolo.com
+ .
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef ASTROLINK4_WORKER_H
+#define ASTROLINK4_WORKER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+
+namespace Astrolink4
+{
+
+// Thread of one unit executing its serial jobs in FIFO order, started on
+// connect. Only this thread talks to the port while it is running, a slow or
+// silent device therefore never holds up another unit.
+class SerialWorker
+{
+public:
+    typedef std::function<void()> Task;
+
+    SerialWorker() = default;
+    ~SerialWorker();
+
+    SerialWorker(const SerialWorker &) = delete;
+    SerialWorker &operator=(const SerialWorker &) = delete;
+
+    void start();
+    // waits for the job in progress, pending and delayed jobs are dropped
+    void stop();
+
+    bool post(Task task);
+    // queued once the delay passed, the thread keeps running other jobs meanwhile
+    bool postAfter(std::chrono::milliseconds delay, Task task);
+    bool isRunning() const;
+    bool isWorkerThread() const;
+    size_t pending() const;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    void run();
+
+    std::thread thread;
+    mutable std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<Task> queue;
+    std::multimap<Clock::time_point, Task> delayed;
+    bool running { false };
+};
+
+}
+
+#endif
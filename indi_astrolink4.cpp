@@ -19,55 +19,119 @@
 
 #include "indicom.h"
 
+#include <array>
+#include <cerrno>
+#include <cmath>
+#include <algorithm>
+#include <fstream>
+
+#include <strings.h>
+#include <sys/stat.h>
+
 #define VERSION_MAJOR 0
 #define VERSION_MINOR 6
 
-#define ASTROLINK4_LEN      100
 #define ASTROLINK4_TIMEOUT  3
+// firmware serial receive buffer, a pipelined write must not overrun it
+#define ASTROLINK4_RX_BUFFER    64
+// kept free in every burst so that an abort written meanwhile still fits
+#define ASTROLINK4_ABORT_RESERVE    2
+// bursts without any reply before the link is considered lost
+#define ASTROLINK4_LINK_TIMEOUTS    2
+// reconnect backoff limits [ms]
+#define ASTROLINK4_RECONNECT_MIN    1000
+#define ASTROLINK4_RECONNECT_MAX    30000
+// failed settings read backoff limits [ms]
+#define ASTROLINK4_SETTINGS_RETRY_MIN   1000
+#define ASTROLINK4_SETTINGS_RETRY_MAX   60000
+// interval of the overshoot watch during a backlash move [ms]
+#define ASTROLINK4_BACKLASH_POLL    20
+// DC focuser sequence: pulses per sequence, end of pulse watch interval and allowed overrun [ms]
+#define ASTROLINK4_DC_SEQUENCE_MAX  64
+#define ASTROLINK4_DC_SEQUENCE_POLL 20
+#define ASTROLINK4_DC_PULSE_TIMEOUT 2000
+// units served by one driver process, see ASTROLINK4_UNITS
+#define ASTROLINK4_MAX_UNITS    16
+
+// command letters with their own serial statistics, in SERIAL_STATS order
+static const char STAT_COMMANDS[] = "qpuenjfRBCHKGSUENJPF";
 
-#define POLLTIME 500
 
 //////////////////////////////////////////////////////////////////////
 /// Delegates
 //////////////////////////////////////////////////////////////////////
-std::unique_ptr<IndiAstrolink4> indiAstrolink4(new IndiAstrolink4());
+// declared first so they outlive the units using them, their threads start with the first connection
+static Astrolink4::SerialReactor serialReactor;
+static Astrolink4::ConfigWriter configFileWriter;
+
+// ASTROLINK4_UNITS in the environment selects how many units this process serves
+static std::vector<std::unique_ptr<IndiAstrolink4>> createUnits()
+{
+    const char *env = getenv("ASTROLINK4_UNITS");
+    int count = std::max(1, std::min(ASTROLINK4_MAX_UNITS, env ? atoi(env) : 1));
+    std::vector<std::unique_ptr<IndiAstrolink4>> units;
+    for(int unit = 1; unit <= count; unit++)
+        units.push_back(std::unique_ptr<IndiAstrolink4>(new IndiAstrolink4(&serialReactor, &configFileWriter, unit)));
+    return units;
+}
+
+static std::vector<std::unique_ptr<IndiAstrolink4>> indiAstrolink4 = createUnits();
 
 void ISGetProperties(const char *dev)
 {
-    indiAstrolink4->ISGetProperties(dev);
+    for(auto &unit : indiAstrolink4)
+        unit->ISGetProperties(dev);
 }
 void ISNewSwitch(const char *dev, const char *name, ISState *states, char *names[], int num)
 {
-    indiAstrolink4->ISNewSwitch(dev, name, states, names, num);
+    for(auto &unit : indiAstrolink4)
+        unit->ISNewSwitch(dev, name, states, names, num);
 }
 void ISNewText(	const char *dev, const char *name, char *texts[], char *names[], int num)
 {
-    indiAstrolink4->ISNewText (dev, name, texts, names, num);
+    for(auto &unit : indiAstrolink4)
+        unit->ISNewText (dev, name, texts, names, num);
 }
 void ISNewNumber(const char *dev, const char *name, double values[], char *names[], int num)
 {
-    indiAstrolink4->ISNewNumber(dev, name, values, names, num);
+    for(auto &unit : indiAstrolink4)
+        unit->ISNewNumber(dev, name, values, names, num);
 }
 void ISNewBLOB (const char *dev, const char *name, int sizes[], int blobsizes[], char *blobs[], char *formats[], char *names[], int num)
 {
-    indiAstrolink4->ISNewBLOB(dev, name, sizes, blobsizes, blobs, formats, names, num);
+    for(auto &unit : indiAstrolink4)
+        unit->ISNewBLOB(dev, name, sizes, blobsizes, blobs, formats, names, num);
 }
 void ISSnoopDevice (XMLEle *root)
 {
-    indiAstrolink4->ISSnoopDevice(root);
+    for(auto &unit : indiAstrolink4)
+        unit->ISSnoopDevice(root);
 }
 
 //////////////////////////////////////////////////////////////////////
 ///Constructor
 //////////////////////////////////////////////////////////////////////
-IndiAstrolink4::IndiAstrolink4() : FI(this), WI(this)
+IndiAstrolink4::IndiAstrolink4(Astrolink4::SerialReactor *reactor, Astrolink4::ConfigWriter *configWriter, int unit)
+    : FI(this), WI(this), reactor(reactor), configWriter(configWriter)
 {
     setVersion(VERSION_MAJOR,VERSION_MINOR);
+    unitName = "AstroLink 4";
+    if(unit > 1)
+        unitName += " " + std::to_string(unit);
+}
+
+IndiAstrolink4::~IndiAstrolink4()
+{
+    // the writer is shared, only this unit's file has to be written before it goes
+    configWriter->flush(configPath);
+    stopReplay();
+    worker.stop();
+    reader.detach();
 }
 
 const char * IndiAstrolink4::getDefaultName()
 {
-    return (char *)"AstroLink 4";
+    return unitName.c_str();
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -76,30 +140,434 @@ const char * IndiAstrolink4::getDefaultName()
 bool IndiAstrolink4::Handshake()
 {
     PortFD = serialConnection->getPortFD();
+    reader.attach(PortFD, reactor);
+    linkState = LINK_UP;
+    linkLost = false;
+    silentExchanges = 0;
+    pendingAbortAcks = 0;
 
-    char res[ASTROLINK4_LEN] = {0};
-    if(sendCommand("#", res))
+    if(handshakeDevice(false))
+    {
+        pollQueued = false;
+        telemetryHistory.allocate();
+        worker.start();
+        resetSchedule();
+        wakePoll(nextTick);
+        return true;
+    }
+    return false;
+}
+
+bool IndiAstrolink4::handshakeDevice(bool publish)
+{
+    // identification and every settings frame in one pipelined burst
+    const char *cmds[] = { "#", "u", "e", "n", "j", "f" };
+    char resId[ASTROLINK4_LEN] = {0}, resU[ASTROLINK4_LEN] = {0}, resE[ASTROLINK4_LEN] = {0};
+    char resN[ASTROLINK4_LEN] = {0}, resJ[ASTROLINK4_LEN] = {0}, resF[ASTROLINK4_LEN] = {0};
+    char *replies[] = { resId, resU, resE, resN, resJ, resF };
+    bool ok[6] = { false };
+    bool allOk = sendCommands(cmds, replies, ok, 6);
+    if(!ok[0])
+        return false;
+    if(strncmp(resId, "#:AstroLink4mini", 15) != 0)
+    {
+        LOG_ERROR("Device not recognized.");
+        return false;
+    }
+    if(!allOk)
+        LOG_WARN("Device settings could not be read, they will be fetched on first change.");
+
+    std::lock_guard<std::recursive_mutex> lock(propertyLock);
+    Astrolink4::FFrame frameF;
+    bool uOk = ok[1] && shadowU.parse(resU);
+    bool eOk = ok[2] && shadowE.parse(resE);
+    bool nOk = ok[3] && shadowN.parse(resN);
+    bool jOk = ok[4] && shadowJ.parse(resJ);
+    bool fOk = ok[5] && frameF.parse(resF);
+    if(!uOk) shadowU.invalidate();
+    if(!eOk) shadowE.invalidate();
+    if(!nOk) shadowN.invalidate();
+    if(!jOk) shadowJ.invalidate();
+    if(fOk)
+        stateCache["f"] = resF;
+
+    // on first connect the properties are not defined yet, they are published with these values
+    if(!publish)
+        applyCachedState();
+    applySettings(uOk ? &shadowU : nullptr, jOk ? &shadowJ : nullptr, eOk ? &shadowE : nullptr, fOk ? &frameF : nullptr,
+                  nOk ? &shadowN : nullptr, IPS_OK, publish);
+    saveStateCache();
+    return true;
+}
+
+bool IndiAstrolink4::reopenPort(const std::string &port, uint32_t baud)
+{
+    int fd = -1;
+    if(tty_connect(port.c_str(), baud, 8, 0, 1, &fd) != TTY_OK)
+        return false;
+
+    // keep the descriptor number owned by the connection plugin, it closes it on disconnect
+    reader.detach();
+    bool ok = dup2(fd, PortFD) >= 0;
+    close(fd);
+    reader.attach(PortFD, reactor);
+    return ok;
+}
+
+void IndiAstrolink4::markLinkLost()
+{
+    // properties stay defined with their last values, marked as not current
+    INumberVectorProperty *numbers[] = { &FocusPosMMNP, &PowerDataNP, &PWMNP, &Sensor2NP, &CompensationValueNP,
+                                         &FocuserSettingsNP, &OtherSettingsNP };
+    ISwitchVectorProperty *switches[] = { &Power1SP, &Power2SP, &Power3SP, &FocuserModeSP, &PowerDefaultOnSP,
+                                          &BuzzerSP, &FocuserCompModeSP, &FocuserManualSP };
+    for(INumberVectorProperty *nvp : numbers)
+    {
+        nvp->s = IPS_ALERT;
+        IDSetNumber(nvp, nullptr);
+    }
+    for(ISwitchVectorProperty *svp : switches)
     {
-        if(strncmp(res, "#:AstroLink4mini", 15) != 0)
+        svp->s = IPS_ALERT;
+        IDSetSwitch(svp, nullptr);
+    }
+    FocusAbsPosNP.setState(IPS_ALERT);
+    FocusAbsPosNP.apply();
+    FocusRelPosNP.setState(IPS_ALERT);
+    FocusRelPosNP.apply();
+}
+
+void IndiAstrolink4::startReconnect()
+{
+    linkState = LINK_RECONNECTING;
+    reconnectAttempts++;
+    std::string port = serialConnection->port();
+    uint32_t baud = serialConnection->baud();
+    bool posted = worker.post([this, port, baud]()
+    {
+        linkLost = false;
+        silentExchanges = 0;
+        pendingAbortAcks = 0;
+        bool ok = reopenPort(port, baud) && handshakeDevice(true);
+        if(!ok)
+            linkLost = true;
+
+        std::lock_guard<std::recursive_mutex> lock(propertyLock);
+        if(ok)
         {
-            LOG_ERROR("Device not recognized.");
-            return false;
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - linkLostAt).count();
+            LOGF_INFO("Link recovered after %.1f s and %d attempt(s).", seconds, reconnectAttempts);
+            finishRequest(&linkState);
+            linkState = LINK_UP;
+            invalidatePublished();
+            resetSchedule();
+            return;
+        }
+
+        int backoff = ASTROLINK4_RECONNECT_MIN << std::min(reconnectAttempts - 1, 5);
+        backoff = std::min(backoff, ASTROLINK4_RECONNECT_MAX);
+        LOGF_DEBUG("Reconnect attempt %d failed, next in %d ms", reconnectAttempts, backoff);
+        linkState = LINK_LOST;
+        nextReconnect = std::chrono::steady_clock::now() + std::chrono::milliseconds(backoff);
+    });
+    if(!posted)
+        linkState = LINK_LOST;
+}
+
+bool IndiAstrolink4::Connect()
+{
+    {
+        std::lock_guard<std::recursive_mutex> lock(propertyLock);
+        startRequest(this, LAT_CONNECT);
+    }
+    // the configuration loaded after connecting must include the pending changes
+    configWriter->flush(configPath);
+    return INDI::DefaultDevice::Connect();
+}
+
+bool IndiAstrolink4::Disconnect()
+{
+    // the runner waits for events on the worker, it has to end first
+    stopReplay();
+    worker.stop();
+    telemetryArchive.close();
+    // the port is closed by the connection plugin, stop receiving on it first
+    reader.detach();
+    {
+        std::lock_guard<std::recursive_mutex> lock(propertyLock);
+        if(!stateCache.empty() || lastQFrame[0] != '\0')
+            saveStateCache();
+    }
+    return INDI::DefaultDevice::Disconnect();
+}
+
+void IndiAstrolink4::TimerHit()
+{
+    if(!isConnected())
+        return;
+    Astrolink4::TraceSpan span("TimerHit", "poll");
+
+    using namespace std::chrono;
+    std::lock_guard<std::recursive_mutex> lock(propertyLock);
+    pollTimer = -1;
+    steady_clock::time_point now = steady_clock::now();
+    milliseconds tick(static_cast<int>(PollRatesN[RATE_FOCUSER_MOVING].value));
+
+    if(linkState == LINK_UP && linkLost)
+    {
+        LOG_WARN("Link to the device lost, reconnecting.");
+        linkState = LINK_LOST;
+        linkLostAt = nextReconnect = now;
+        reconnectAttempts = 0;
+        startRequest(&linkState, LAT_RECOVERY);
+        markLinkLost();
+    }
+    if(linkState != LINK_UP)
+    {
+        if(linkState == LINK_LOST && now >= nextReconnect)
+            startReconnect();
+        wakePoll(now + tick);
+        return;
+    }
+
+    // lateness is measured against the planned deadline, a tick later than the fast rate is a miss
+    PollStatsN[POLL_TICKS].value++;
+    double lateMs = duration<double, std::milli>(now - nextTick).count();
+    pollJitter.record(std::fabs(lateMs));
+    if(lateMs > PollStatsN[POLL_MAX_LATE].value)
+        PollStatsN[POLL_MAX_LATE].value = lateMs;
+    if(now - nextTick >= tick)
+        PollStatsN[POLL_MISSES].value++;
+
+    if(busQuiet && now - quietSince >= duration<double>(QuietN[QUIET_MAX].value))
+    {
+        LOG_WARN("Camera readout takes too long, polling resumed.");
+        quietExpired = true;
+        updateQuiet();
+    }
+    uint8_t due = dueSubsystems(now);
+    // a move in progress is still tracked, everything else waits for the readout to end
+    if(busQuiet)
+        due &= focuserMoving ? (POLL_FOCUSER | POLL_POSITION) : 0;
+    // polls come from the transcript while it is replayed
+    if(replay.isActive())
+        due = 0;
+    if(due)
+    {
+        pollPending |= due;
+        // skip posting if the previous poll is still queued, it picks up the pending bits
+        if(!pollQueued.exchange(true))
+        {
+            worker.post([this]()
+            {
+                pollQueued = false;
+                uint8_t subsystems = pollPending.exchange(0);
+                transcript.record(Astrolink4::TranscriptEntry::POLL, subsystems);
+                sensorRead(subsystems);
+            });
+        }
+    }
+
+    // sleep until the earliest subsystem, settings retry or quiet period limit is due
+    nextTick = std::min(std::min(nextDue[0], nextDue[1]), nextDue[2]);
+    if(settingsStale() && nextSettingsRead > now)
+        nextTick = std::min(nextTick, nextSettingsRead);
+    if(busQuiet && !quietExpired)
+        nextTick = std::min(nextTick, quietSince + duration_cast<steady_clock::duration>(duration<double>(QuietN[QUIET_MAX].value)));
+    wakePoll(nextTick);
+}
+
+void IndiAstrolink4::wakePoll(std::chrono::steady_clock::time_point at)
+{
+    using namespace std::chrono;
+    std::lock_guard<std::recursive_mutex> lock(propertyLock);
+    // asked for on the worker, the armed timer fires as planned and picks up the new deadlines
+    if(std::this_thread::get_id() != eventThread || (pollTimer >= 0 && pollTimerAt <= at))
+        return;
+    if(pollTimer >= 0)
+        RemoveTimer(pollTimer);
+    pollTimerAt = at;
+    pollTimer = SetTimer(std::max<int>(1, duration_cast<milliseconds>(at - steady_clock::now()).count()));
+}
+
+void IndiAstrolink4::pollFocuserSoon()
+{
+    using namespace std::chrono;
+    std::lock_guard<std::recursive_mutex> lock(propertyLock);
+    // the idle period may still be running, the move is tracked from the next fast tick
+    steady_clock::time_point at = steady_clock::now() +
+                                  duration_cast<steady_clock::duration>(duration<double, std::milli>(PollRatesN[RATE_FOCUSER_MOVING].value));
+    if(at < nextDue[0])
+        nextDue[0] = at;
+    wakePoll(at);
+}
+
+void IndiAstrolink4::resetSchedule()
+{
+    nextTick = std::chrono::steady_clock::now();
+    for(auto &due : nextDue)
+        due = nextTick;
+    nextFullFrame = nextTick;
+    nextSettingsRead = nextTick;
+    settingsAttempts = 0;
+    pollPending = 0;
+}
+
+void IndiAstrolink4::updateQuiet()
+{
+    bool exposing = CcdExposureNP.s == IPS_BUSY;
+    if(!exposing)
+        quietExpired = false;
+    bool quiet = exposing && !quietExpired && QuietBusS[QUIET_OFF].s != ISS_ON &&
+                 (QuietBusS[QUIET_EXPOSURE].s == ISS_ON || CcdExposureN[0].value <= QuietN[QUIET_LEAD].value);
+    if(quiet == busQuiet)
+        return;
+    busQuiet = quiet;
+    if(quiet)
+    {
+        quietSince = std::chrono::steady_clock::now();
+        LOG_DEBUG("Camera reading out, routine polling paused.");
+        wakePoll(quietSince + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                     std::chrono::duration<double>(QuietN[QUIET_MAX].value)));
+        return;
+    }
+    // every subsystem becomes due at once, the next tick catches up in one burst
+    LOGF_DEBUG("Routine polling resumed after %.1f s.",
+               std::chrono::duration<double>(std::chrono::steady_clock::now() - quietSince).count());
+    resetSchedule();
+    wakePoll(nextTick);
+}
+
+uint8_t IndiAstrolink4::dueSubsystems(std::chrono::steady_clock::time_point now)
+{
+    using namespace std::chrono;
+    uint8_t due = 0;
+    const double periods[3] =
+    {
+        focuserMoving ? PollRatesN[RATE_FOCUSER_MOVING].value : PollRatesN[RATE_FOCUSER_IDLE].value,
+        PollRatesN[RATE_POWER].value,
+        PollRatesN[RATE_ENVIRONMENT].value
+    };
+    for(int i = 0; i < 3; i++)
+    {
+        if(now < nextDue[i])
+            continue;
+        due |= (1 << i);
+        steady_clock::duration period = duration_cast<steady_clock::duration>(duration<double, std::milli>(periods[i]));
+        nextDue[i] += period;
+        if(nextDue[i] <= now)
+            nextDue[i] = now + period;
+    }
+
+    // while the stepper moves the fast focuser polls ask only for the position,
+    // any full frame requested by the other subsystems restarts the full frame period
+    if(trackPosition && (due & POLL_TELEMETRY))
+    {
+        if(fullFrameDue.exchange(false) || (due & (POLL_POWER | POLL_ENVIRONMENT)) || now >= nextFullFrame)
+        {
+            due |= POLL_FOCUSER;
+            nextFullFrame = now + duration_cast<steady_clock::duration>(duration<double, std::milli>(PollRatesN[RATE_FOCUSER_FULL].value));
         }
         else
+            due = (due & ~POLL_FOCUSER) | POLL_POSITION;
+    }
+
+    if(settingsStale() && now >= nextSettingsRead)
+        due |= POLL_SETTINGS;
+    return due;
+}
+
+bool IndiAstrolink4::settingsStale()
+{
+    std::lock_guard<std::recursive_mutex> lock(propertyLock);
+    return FocuserSettingsNP.s != IPS_OK || FocuserModeSP.s != IPS_OK || PowerDefaultOnSP.s != IPS_OK || BuzzerSP.s != IPS_OK ||
+           FocuserCompModeSP.s != IPS_OK || FocuserManualSP.s != IPS_OK || OtherSettingsNP.s != IPS_OK;
+}
+
+void IndiAstrolink4::queueTask(std::function<bool()> task, std::function<void(bool)> done, const char *property)
+{
+    {
+        // keep the order, commands queued after this task must not join an earlier batch
+        std::lock_guard<std::mutex> lock(batchLock);
+        openBatch.reset();
+    }
+    bool posted = worker.post([this, task, done, property]()
+    {
+        bool ok = task();
+        if(done)
         {
-            SetTimer(POLLTIME);
-            return true;
+            std::lock_guard<std::recursive_mutex> lock(propertyLock);
+            invalidatePublished(property);
+            done(ok);
         }
+    });
+    if(!posted && done)
+    {
+        std::lock_guard<std::recursive_mutex> lock(propertyLock);
+        done(false);
     }
-    return false;
 }
 
-void IndiAstrolink4::TimerHit()
+void IndiAstrolink4::queueCommand(const std::string &cmd, std::function<void(bool)> done, const char *property)
+{
+    std::atomic<uint32_t> *axis = moveAbortsFor(cmd.c_str());
+    uint32_t aborts = axis ? axis->load() : 0;
+    std::shared_ptr<CommandBatch> batch;
+    {
+        std::lock_guard<std::mutex> lock(batchLock);
+        if(openBatch)
+        {
+            openBatch->push_back({cmd, done, aborts, property});
+            return;
+        }
+        batch = openBatch = std::make_shared<CommandBatch>();
+        batch->push_back({cmd, done, aborts, property});
+    }
+    bool posted = worker.post([this, batch]()
+    {
+        flushCommands(batch);
+    });
+    if(!posted)
+    {
+        std::lock_guard<std::mutex> lock(batchLock);
+        if(openBatch == batch)
+            openBatch.reset();
+        std::lock_guard<std::recursive_mutex> propLock(propertyLock);
+        for(const auto &command : *batch)
+            if(command.done)
+                command.done(false);
+    }
+}
+
+void IndiAstrolink4::flushCommands(std::shared_ptr<CommandBatch> batch)
 {
-    if(isConnected())
     {
-        sensorRead();
-        SetTimer(POLLTIME);
+        std::lock_guard<std::mutex> lock(batchLock);
+        if(openBatch == batch)
+            openBatch.reset();
+    }
+
+    size_t count = batch->size();
+    std::vector<const char *> cmds(count);
+    std::vector<std::array<char, ASTROLINK4_LEN>> buffers(count);
+    std::vector<char *> res(count);
+    std::vector<uint32_t> aborts(count);
+    std::unique_ptr<bool[]> ok(new bool[count]);
+    for(size_t i = 0; i < count; i++)
+    {
+        cmds[i] = (*batch)[i].cmd.c_str();
+        res[i] = buffers[i].data();
+        aborts[i] = (*batch)[i].aborts;
+    }
+    // a move must not start after the abort that was meant to stop it
+    sendCommands(cmds.data(), res.data(), ok.get(), count, aborts.data());
+
+    std::lock_guard<std::recursive_mutex> lock(propertyLock);
+    for(size_t i = 0; i < count; i++)
+    {
+        invalidatePublished((*batch)[i].property);
+        if((*batch)[i].done)
+            (*batch)[i].done(ok[i]);
     }
 }
 
@@ -109,6 +577,7 @@ void IndiAstrolink4::TimerHit()
 bool IndiAstrolink4::initProperties()
 {
     INDI::DefaultDevice::initProperties();
+    resolveConfigPath();
 
     setDriverInterface(AUX_INTERFACE | FOCUSER_INTERFACE | WEATHER_INTERFACE);
 
@@ -163,6 +632,14 @@ bool IndiAstrolink4::initProperties()
     IUFillSwitch(&CompensateNowS[0], "COMP_NOW", "Compensate now", ISS_OFF);
     IUFillSwitchVector(&CompensateNowSP, CompensateNowS, 1, getDeviceName(), "COMP_NOW", "Compensate now", FOCUS_TAB, IP_RW, ISR_ATMOST1, 60, IPS_IDLE);
 
+    // compensation computed by the driver, uses FS_COMPENSATION and FS_COMP_THRESHOLD
+    IUFillSwitch(&DriverCompS[DRIVER_COMP_ON], "DRIVER_COMP_ON", "ON", ISS_OFF);
+    IUFillSwitch(&DriverCompS[DRIVER_COMP_OFF], "DRIVER_COMP_OFF", "OFF", ISS_ON);
+    IUFillSwitchVector(&DriverCompSP, DriverCompS, 2, getDeviceName(), "DRIVER_COMP", "Driver compensation", SETTINGS_TAB, IP_RW, ISR_1OFMANY, 60, IPS_IDLE);
+
+    IUFillNumber(&CompFilterN[0], "COMP_FILTER_TAU", "Time constant [s]", "%.0f", 0, 3600, 10, 120);
+    IUFillNumberVector(&CompFilterNP, CompFilterN, 1, getDeviceName(), "COMP_FILTER", "Temperature filter", SETTINGS_TAB, IP_RW, 60, IPS_IDLE);
+
     IUFillNumber(&FocusPosMMN[0], "FOC_POS_MM", "Position [mm]", "%.3f", 0.0, 200.0, 0.001, 0.0);
     IUFillNumberVector(&FocusPosMMNP, FocusPosMMN, 1, getDeviceName(), "FOC_POS_MM", "Position [mm]", FOCUS_TAB, IP_RO, 60, IPS_IDLE);
 
@@ -238,6 +715,148 @@ bool IndiAstrolink4::initProperties()
     IUFillSwitch(&DCFocAbortS[0], "DC_FOC_ABORT", "STOP", ISS_OFF);
     IUFillSwitchVector(&DCFocAbortSP, DCFocAbortS, 1, getDeviceName(), "DC_FOC_ABORT", "DC Focuser stop", DCFOCUSER_TAB, IP_RW, ISR_ATMOST1, 60, IPS_IDLE);
 
+    IUFillText(&DCFocSequenceT[0], "DC_SEQUENCE", "Pulses dir:pwm:ms", "");
+    IUFillTextVector(&DCFocSequenceTP, DCFocSequenceT, 1, getDeviceName(), "DC_FOC_SEQUENCE", "DC Focuser sequence", DCFOCUSER_TAB, IP_RW, 60, IPS_IDLE);
+
+    // publishing
+    IUFillNumber(&PublishDeadbandN[DB_VOLTAGE], "DB_VOLTAGE", "Voltage [V]", "%.2f", 0, 5, 0.01, 0.05);
+    IUFillNumber(&PublishDeadbandN[DB_CURRENT], "DB_CURRENT", "Current [A]", "%.2f", 0, 5, 0.01, 0.05);
+    IUFillNumber(&PublishDeadbandN[DB_ENERGY], "DB_ENERGY", "Energy [Ah, Wh]", "%.2f", 0, 100, 0.1, 0.1);
+    IUFillNumber(&PublishDeadbandN[DB_TEMPERATURE], "DB_TEMPERATURE", "Temperature [C]", "%.2f", 0, 10, 0.1, 0.1);
+    IUFillNumber(&PublishDeadbandN[DB_PWM], "DB_PWM", "PWM [%]", "%.0f", 0, 50, 1, 0);
+    IUFillNumber(&PublishDeadbandN[DB_MAX_INTERVAL], "DB_MAX_INTERVAL", "Forced refresh [s]", "%.0f", 1, 3600, 1, 10);
+    IUFillNumberVector(&PublishDeadbandNP, PublishDeadbandN, 6, getDeviceName(), "PUBLISH_DEADBANDS", "Update deadbands", OPTIONS_TAB, IP_RW, 60, IPS_IDLE);
+
+    // polling
+    IUFillNumber(&PollRatesN[RATE_FOCUSER_MOVING], "RATE_FOCUSER_MOVING", "Focuser moving [ms]", "%.0f", 50, 1000, 10, 50);
+    IUFillNumber(&PollRatesN[RATE_FOCUSER_IDLE], "RATE_FOCUSER_IDLE", "Focuser idle [ms]", "%.0f", 100, 60000, 100, 2000);
+    IUFillNumber(&PollRatesN[RATE_POWER], "RATE_POWER", "Power data [ms]", "%.0f", 100, 60000, 100, 2000);
+    IUFillNumber(&PollRatesN[RATE_ENVIRONMENT], "RATE_ENVIRONMENT", "Environment [ms]", "%.0f", 100, 600000, 100, 10000);
+    IUFillNumber(&PollRatesN[RATE_FOCUSER_FULL], "RATE_FOCUSER_FULL", "Full frame when moving [ms]", "%.0f", 100, 10000, 100, 500);
+    IUFillNumberVector(&PollRatesNP, PollRatesN, 5, getDeviceName(), "POLL_RATES", "Polling periods", OPTIONS_TAB, IP_RW, 60, IPS_IDLE);
+
+    // camera snooping, routine polls pause while the camera reads out
+    IUFillText(&ActiveDeviceT[0], "ACTIVE_CCD", "Camera", "CCD Simulator");
+    IUFillTextVector(&ActiveDeviceTP, ActiveDeviceT, 1, getDeviceName(), "ACTIVE_DEVICES", "Snoop devices", OPTIONS_TAB, IP_RW, 60, IPS_IDLE);
+
+    IUFillNumber(&CcdExposureN[0], "CCD_EXPOSURE_VALUE", "Duration (s)", "%.2f", 0, 36000, 0, 0);
+    IUFillNumberVector(&CcdExposureNP, CcdExposureN, 1, ActiveDeviceT[0].text, "CCD_EXPOSURE", "Expose", "Main Control", IP_RW, 60, IPS_IDLE);
+    IDSnoopDevice(ActiveDeviceT[0].text, "CCD_EXPOSURE");
+
+    IUFillSwitch(&QuietBusS[QUIET_OFF], "QUIET_OFF", "Off", ISS_ON);
+    IUFillSwitch(&QuietBusS[QUIET_READOUT], "QUIET_READOUT", "Readout", ISS_OFF);
+    IUFillSwitch(&QuietBusS[QUIET_EXPOSURE], "QUIET_EXPOSURE", "Whole exposure", ISS_OFF);
+    IUFillSwitchVector(&QuietBusSP, QuietBusS, 3, getDeviceName(), "QUIET_BUS", "Pause polling", OPTIONS_TAB, IP_RW, ISR_1OFMANY, 60, IPS_IDLE);
+
+    IUFillNumber(&QuietN[QUIET_LEAD], "QUIET_LEAD", "Before readout [s]", "%.1f", 0, 60, 0.5, 1);
+    IUFillNumber(&QuietN[QUIET_MAX], "QUIET_MAX", "Longest pause [s]", "%.0f", 1, 3600, 10, 120);
+    IUFillNumberVector(&QuietNP, QuietN, 2, getDeviceName(), "QUIET_SETTINGS", "Pause limits", OPTIONS_TAB, IP_RW, 60, IPS_IDLE);
+
+    IUFillNumber(&PollStatsN[POLL_TICKS], "POLL_TICKS", "Ticks", "%.0f", 0, 1e12, 1, 0);
+    IUFillNumber(&PollStatsN[POLL_MISSES], "POLL_MISSES", "Missed deadlines", "%.0f", 0, 1e12, 1, 0);
+    IUFillNumber(&PollStatsN[POLL_MAX_LATE], "POLL_MAX_LATE", "Max lateness [ms]", "%.1f", 0, 1e9, 1, 0);
+    IUFillNumberVector(&PollStatsNP, PollStatsN, 3, getDeviceName(), "POLL_STATS", "Polling", OPTIONS_TAB, IP_RO, 60, IPS_IDLE);
+
+    // request latency
+    const char *latencyNames[LAT_COUNT] = { "MOVE", "POWER", "SETTINGS", "CONNECT", "RECOVERY" };
+    const char *latencyLabels[LAT_COUNT] = { "Move", "Power", "Settings", "Connect", "Link recovery" };
+    for(int i = 0; i < LAT_COUNT; i++)
+    {
+        const char *suffixes[4] = { "COUNT", "P50", "P95", "P99" };
+        for(int j = 0; j < 4; j++)
+        {
+            char elementName[MAXINDINAME], elementLabel[MAXINDILABEL];
+            snprintf(elementName, MAXINDINAME, "LAT_%s_%s", latencyNames[i], suffixes[j]);
+            snprintf(elementLabel, MAXINDILABEL, "%s %s%s", latencyLabels[i], j ? suffixes[j] : "count", j ? " [ms]" : "");
+            IUFillNumber(&LatencyN[i * 4 + j], elementName, elementLabel, j ? "%.1f" : "%.0f", 0, 1e9, 1, 0);
+        }
+    }
+    IUFillNumberVector(&LatencyNP, LatencyN, LAT_COUNT * 4, getDeviceName(), "REQUEST_LATENCY", "Request latency", OPTIONS_TAB, IP_RO, 60, IPS_IDLE);
+
+    IUFillText(&LatencyFileT[0], "LATENCY_FILE", "File", "/tmp/astrolink4_latency.json");
+    IUFillTextVector(&LatencyFileTP, LatencyFileT, 1, getDeviceName(), "LATENCY_FILE", "Latency export", OPTIONS_TAB, IP_RW, 60, IPS_IDLE);
+
+    // span tracing, shared by all units of the process
+    IUFillSwitch(&TraceS[TRACE_ON], "TRACE_ON", "ON", ISS_OFF);
+    IUFillSwitch(&TraceS[TRACE_OFF], "TRACE_OFF", "OFF", ISS_ON);
+    IUFillSwitchVector(&TraceSP, TraceS, 2, getDeviceName(), "TRACE", "Tracing", OPTIONS_TAB, IP_RW, ISR_1OFMANY, 60, IPS_IDLE);
+
+    IUFillSwitch(&TraceActionS[0], "TRACE_DUMP", "Dump", ISS_OFF);
+    IUFillSwitchVector(&TraceActionSP, TraceActionS, 1, getDeviceName(), "TRACE_ACTION", "Trace", OPTIONS_TAB, IP_RW, ISR_ATMOST1, 60, IPS_IDLE);
+
+    IUFillText(&TraceFileT[0], "TRACE_PATH", "File", "/tmp/astrolink4_trace.json");
+    IUFillTextVector(&TraceFileTP, TraceFileT, 1, getDeviceName(), "TRACE_FILE", "Trace file", OPTIONS_TAB, IP_RW, 60, IPS_IDLE);
+
+    // serial transcript
+    IUFillText(&TranscriptFileT[0], "TRANSCRIPT_PATH", "File", "/tmp/astrolink4_transcript.al4s");
+    IUFillTextVector(&TranscriptFileTP, TranscriptFileT, 1, getDeviceName(), "TRANSCRIPT_FILE", "Transcript file", OPTIONS_TAB, IP_RW, 60, IPS_IDLE);
+
+    IUFillSwitch(&TranscriptS[TRANSCRIPT_OFF], "TRANSCRIPT_OFF", "Off", ISS_ON);
+    IUFillSwitch(&TranscriptS[TRANSCRIPT_RECORD], "TRANSCRIPT_RECORD", "Record", ISS_OFF);
+    IUFillSwitch(&TranscriptS[TRANSCRIPT_REPLAY], "TRANSCRIPT_REPLAY", "Replay", ISS_OFF);
+    IUFillSwitch(&TranscriptS[TRANSCRIPT_REPLAY_FAST], "TRANSCRIPT_REPLAY_FAST", "Replay fast", ISS_OFF);
+    IUFillSwitchVector(&TranscriptSP, TranscriptS, 4, getDeviceName(), "TRANSCRIPT_ACTION", "Transcript", OPTIONS_TAB, IP_RW, ISR_1OFMANY, 60, IPS_IDLE);
+
+    IUFillNumber(&TranscriptStatsN[0], "REPLAY_EVENTS", "Events replayed", "%.0f", 0, 1e12, 1, 0);
+    IUFillNumber(&TranscriptStatsN[1], "REPLAY_MATCHED", "Bursts matched", "%.0f", 0, 1e12, 1, 0);
+    IUFillNumber(&TranscriptStatsN[2], "REPLAY_DIVERGED", "Bursts diverged", "%.0f", 0, 1e12, 1, 0);
+    IUFillNumber(&TranscriptStatsN[3], "REPLAY_SKIPPED", "Bursts skipped", "%.0f", 0, 1e12, 1, 0);
+    IUFillNumberVector(&TranscriptStatsNP, TranscriptStatsN, 4, getDeviceName(), "TRANSCRIPT_STATS", "Replay", OPTIONS_TAB, IP_RO, 60, IPS_IDLE);
+
+    IUFillSwitch(&LatencyActionS[LAT_EXPORT], "LATENCY_EXPORT", "Export", ISS_OFF);
+    IUFillSwitch(&LatencyActionS[LAT_RESET], "LATENCY_RESET", "Reset", ISS_OFF);
+    IUFillSwitchVector(&LatencyActionSP, LatencyActionS, 2, getDeviceName(), "LATENCY_ACTION", "Latency", OPTIONS_TAB, IP_RW, ISR_ATMOST1, 60, IPS_IDLE);
+
+    // telemetry history
+    IUFillNumber(&TelemetryRangeN[0], "TELEMETRY_MINUTES", "Last minutes", "%.0f", 1, 1440, 1, 60);
+    IUFillNumberVector(&TelemetryRangeNP, TelemetryRangeN, 1, getDeviceName(), "TELEMETRY_RANGE", "Export range", HISTORY_TAB, IP_RW, 60, IPS_IDLE);
+
+    IUFillSwitch(&TelemetryFormatS[TELEMETRY_CSV], "TELEMETRY_CSV", "CSV", ISS_ON);
+    IUFillSwitch(&TelemetryFormatS[TELEMETRY_BINARY], "TELEMETRY_BINARY", "Binary", ISS_OFF);
+    IUFillSwitchVector(&TelemetryFormatSP, TelemetryFormatS, 2, getDeviceName(), "TELEMETRY_FORMAT", "Export format", HISTORY_TAB, IP_RW, ISR_1OFMANY, 60, IPS_IDLE);
+
+    IUFillSwitch(&TelemetryExportS[0], "TELEMETRY_EXPORT", "Export", ISS_OFF);
+    IUFillSwitchVector(&TelemetryExportSP, TelemetryExportS, 1, getDeviceName(), "TELEMETRY_ACTION", "Telemetry", HISTORY_TAB, IP_RW, ISR_ATMOST1, 60, IPS_IDLE);
+
+    IUFillBLOB(&TelemetryB[0], "TELEMETRY_DATA", "Data", "");
+    IUFillBLOBVector(&TelemetryBP, TelemetryB, 1, getDeviceName(), "TELEMETRY", "Telemetry data", HISTORY_TAB, IP_RO, 60, IPS_IDLE);
+
+    // telemetry archive
+    IUFillSwitch(&ArchiveS[ARCHIVE_ON], "ARCHIVE_ON", "ON", ISS_OFF);
+    IUFillSwitch(&ArchiveS[ARCHIVE_OFF], "ARCHIVE_OFF", "OFF", ISS_ON);
+    IUFillSwitchVector(&ArchiveSP, ArchiveS, 2, getDeviceName(), "TELEMETRY_ARCHIVE", "Archive", HISTORY_TAB, IP_RW, ISR_1OFMANY, 60, IPS_IDLE);
+
+    IUFillText(&ArchiveFileT[0], "ARCHIVE_PATH", "File", archivePath().c_str());
+    IUFillTextVector(&ArchiveFileTP, ArchiveFileT, 1, getDeviceName(), "ARCHIVE_FILE", "Archive file", HISTORY_TAB, IP_RW, 60, IPS_IDLE);
+
+    IUFillNumber(&ArchiveLimitsN[ARCHIVE_SIZE], "ARCHIVE_SIZE", "File size [MB]", "%.0f", 1, 1024, 1, 16);
+    IUFillNumber(&ArchiveLimitsN[ARCHIVE_KEEP], "ARCHIVE_KEEP", "Old files kept", "%.0f", 0, 100, 1, 7);
+    IUFillNumberVector(&ArchiveLimitsNP, ArchiveLimitsN, 2, getDeviceName(), "ARCHIVE_LIMITS", "Archive rotation", HISTORY_TAB, IP_RW, 60, IPS_IDLE);
+
+    // serial link statistics
+    for(int i = 0; i < STAT_COMMAND_COUNT; i++)
+    {
+        const char *suffixes[5] = { "REQ", "TIMEOUT", "MISMATCH", "RTT_P50", "RTT_P99" };
+        const char *labels[5] = { "requests", "timeouts", "echo mismatches", "RTT p50 [ms]", "RTT p99 [ms]" };
+        for(int j = 0; j < 5; j++)
+        {
+            char elementName[MAXINDINAME], elementLabel[MAXINDILABEL];
+            snprintf(elementName, MAXINDINAME, "SER_%c_%s", STAT_COMMANDS[i], suffixes[j]);
+            snprintf(elementLabel, MAXINDILABEL, "%c %s", STAT_COMMANDS[i], labels[j]);
+            IUFillNumber(&SerialStatsN[i * 5 + j], elementName, elementLabel, j < 3 ? "%.0f" : "%.2f", 0, 1e12, 1, 0);
+        }
+    }
+    IUFillNumber(&SerialStatsN[STAT_COMMAND_COUNT * 5], "POLL_JITTER_P50", "Poll jitter p50 [ms]", "%.2f", 0, 1e9, 1, 0);
+    IUFillNumber(&SerialStatsN[STAT_COMMAND_COUNT * 5 + 1], "POLL_JITTER_P99", "Poll jitter p99 [ms]", "%.2f", 0, 1e9, 1, 0);
+    IUFillNumber(&SerialStatsN[STAT_COMMAND_COUNT * 5 + 2], "ABORT_WIRE_P50", "Abort to wire p50 [ms]", "%.2f", 0, 1e9, 1, 0);
+    IUFillNumber(&SerialStatsN[STAT_COMMAND_COUNT * 5 + 3], "ABORT_WIRE_P99", "Abort to wire p99 [ms]", "%.2f", 0, 1e9, 1, 0);
+    IUFillNumber(&SerialStatsN[STAT_COMMAND_COUNT * 5 + 4], "ABORT_WIRE_MAX", "Abort to wire max [ms]", "%.2f", 0, 1e9, 1, 0);
+    IUFillNumberVector(&SerialStatsNP, SerialStatsN, STAT_COMMAND_COUNT * 5 + 5, getDeviceName(), "SERIAL_STATS", "Serial link", OPTIONS_TAB, IP_RO, 60, IPS_IDLE);
+
+    IUFillNumber(&PublishStatsN[PUB_SENT], "PUB_SENT", "Published", "%.0f", 0, 1e12, 1, 0);
+    IUFillNumber(&PublishStatsN[PUB_SUPPRESSED], "PUB_SUPPRESSED", "Suppressed", "%.0f", 0, 1e12, 1, 0);
+    IUFillNumberVector(&PublishStatsNP, PublishStatsN, 2, getDeviceName(), "PUBLISH_STATS", "Updates", OPTIONS_TAB, IP_RO, 60, IPS_IDLE);
+
     serialConnection = new Connection::Serial(this);
     serialConnection->registerHandshake([&]()
     {
@@ -274,13 +893,40 @@ bool IndiAstrolink4::updateProperties()
         defineProperty(&FocuserManualSP);
         defineProperty(&CompensationValueNP);
         defineProperty(&CompensateNowSP);
+        defineProperty(&DriverCompSP);
+        defineProperty(&CompFilterNP);
         defineProperty(&PowerDefaultOnSP);
         defineProperty(&OtherSettingsNP);
         defineProperty(&DCFocDirSP);
         defineProperty(&DCFocTimeNP);
         defineProperty(&DCFocAbortSP);
+        defineProperty(&DCFocSequenceTP);
         defineProperty(&PowerControlsLabelsTP);
         defineProperty(&BuzzerSP);
+        defineProperty(&PublishDeadbandNP);
+        defineProperty(&PublishStatsNP);
+        defineProperty(&PollRatesNP);
+        defineProperty(&PollStatsNP);
+        defineProperty(&ActiveDeviceTP);
+        defineProperty(&QuietBusSP);
+        defineProperty(&QuietNP);
+        defineProperty(&LatencyNP);
+        defineProperty(&LatencyFileTP);
+        defineProperty(&TraceSP);
+        defineProperty(&TraceActionSP);
+        defineProperty(&TraceFileTP);
+        defineProperty(&TranscriptFileTP);
+        defineProperty(&TranscriptSP);
+        defineProperty(&TranscriptStatsNP);
+        defineProperty(&LatencyActionSP);
+        defineProperty(&SerialStatsNP);
+        defineProperty(&TelemetryRangeNP);
+        defineProperty(&TelemetryFormatSP);
+        defineProperty(&TelemetryExportSP);
+        defineProperty(&TelemetryBP);
+        defineProperty(&ArchiveSP);
+        defineProperty(&ArchiveFileTP);
+        defineProperty(&ArchiveLimitsNP);
     }
     else
     {
@@ -295,16 +941,43 @@ bool IndiAstrolink4::updateProperties()
         deleteProperty(FocuserModeSP.name);
         deleteProperty(CompensateNowSP.name);
         deleteProperty(CompensationValueNP.name);
+        deleteProperty(DriverCompSP.name);
+        deleteProperty(CompFilterNP.name);
         deleteProperty(PowerDefaultOnSP.name);
         deleteProperty(OtherSettingsNP.name);
         deleteProperty(DCFocTimeNP.name);
         deleteProperty(DCFocDirSP.name);
         deleteProperty(DCFocAbortSP.name);
+        deleteProperty(DCFocSequenceTP.name);
         deleteProperty(BuzzerSP.name);
         deleteProperty(FocuserCompModeSP.name);
         deleteProperty(FocuserManualSP.name);
         deleteProperty(FocusPosMMNP.name);
         deleteProperty(PowerControlsLabelsTP.name);
+        deleteProperty(PublishDeadbandNP.name);
+        deleteProperty(PublishStatsNP.name);
+        deleteProperty(PollRatesNP.name);
+        deleteProperty(PollStatsNP.name);
+        deleteProperty(ActiveDeviceTP.name);
+        deleteProperty(QuietBusSP.name);
+        deleteProperty(QuietNP.name);
+        deleteProperty(LatencyNP.name);
+        deleteProperty(LatencyFileTP.name);
+        deleteProperty(TraceSP.name);
+        deleteProperty(TraceActionSP.name);
+        deleteProperty(TraceFileTP.name);
+        deleteProperty(TranscriptFileTP.name);
+        deleteProperty(TranscriptSP.name);
+        deleteProperty(TranscriptStatsNP.name);
+        deleteProperty(LatencyActionSP.name);
+        deleteProperty(SerialStatsNP.name);
+        deleteProperty(TelemetryRangeNP.name);
+        deleteProperty(TelemetryFormatSP.name);
+        deleteProperty(TelemetryExportSP.name);
+        deleteProperty(TelemetryBP.name);
+        deleteProperty(ArchiveSP.name);
+        deleteProperty(ArchiveFileTP.name);
+        deleteProperty(ArchiveLimitsNP.name);
         FI::updateProperties();
         WI::updateProperties();
     }
@@ -316,19 +989,79 @@ bool IndiAstrolink4::ISNewNumber (const char *dev, const char *name, double valu
 {
     if (dev && !strcmp(dev, getDeviceName()))
     {
+        Astrolink4::TraceSpan span("ISNewNumber", "client", name);
+        std::lock_guard<std::recursive_mutex> lock(propertyLock);
+        invalidatePublished(name);
         char cmd[ASTROLINK4_LEN] = {0};
-        char res[ASTROLINK4_LEN] = {0};
+
+        // publishing deadbands
+        if (!strcmp(name, PublishDeadbandNP.name))
+        {
+            IUUpdateNumber(&PublishDeadbandNP, values, names, n);
+            PublishDeadbandNP.s = IPS_OK;
+            IDSetNumber(&PublishDeadbandNP, nullptr);
+            return true;
+        }
+
+        // telemetry export range
+        if (!strcmp(name, TelemetryRangeNP.name))
+        {
+            IUUpdateNumber(&TelemetryRangeNP, values, names, n);
+            TelemetryRangeNP.s = IPS_OK;
+            IDSetNumber(&TelemetryRangeNP, nullptr);
+            return true;
+        }
+
+        // archive rotation
+        if (!strcmp(name, ArchiveLimitsNP.name))
+        {
+            IUUpdateNumber(&ArchiveLimitsNP, values, names, n);
+            ArchiveLimitsNP.s = IPS_OK;
+            IDSetNumber(&ArchiveLimitsNP, nullptr);
+            configureArchive();
+            return true;
+        }
+
+        // polling pause limits
+        if (!strcmp(name, QuietNP.name))
+        {
+            IUUpdateNumber(&QuietNP, values, names, n);
+            QuietNP.s = IPS_OK;
+            IDSetNumber(&QuietNP, nullptr);
+            updateQuiet();
+            return true;
+        }
+
+        // temperature filter of the driver compensation
+        if (!strcmp(name, CompFilterNP.name))
+        {
+            IUUpdateNumber(&CompFilterNP, values, names, n);
+            CompFilterNP.s = IPS_OK;
+            IDSetNumber(&CompFilterNP, nullptr);
+            return true;
+        }
+
+        // polling periods
+        if (!strcmp(name, PollRatesNP.name))
+        {
+            IUUpdateNumber(&PollRatesNP, values, names, n);
+            PollRatesNP.s = IPS_OK;
+            IDSetNumber(&PollRatesNP, nullptr);
+            resetSchedule();
+            wakePoll(nextTick);
+            return true;
+        }
         
         // handle PWM
         if (!strcmp(name, PWMNP.name))
         {
-            bool allOk = true;
+            std::vector<std::string> commands;
             if(PWMN[0].value != values[0])
             {
                 if(AutoPWMS[0].s == ISS_OFF)
                 {
                     sprintf(cmd, "B:0:%d", static_cast<uint8_t>(values[0]));
-                    allOk = allOk && sendCommand(cmd, res);
+                    commands.push_back(cmd);
                 }
                 else
                 {
@@ -340,64 +1073,86 @@ bool IndiAstrolink4::ISNewNumber (const char *dev, const char *name, double valu
                 if(AutoPWMS[1].s == ISS_OFF)
                 {
                     sprintf(cmd, "B:1:%d", static_cast<uint8_t>(values[1]));
-                    allOk = allOk && sendCommand(cmd, res);
+                    commands.push_back(cmd);
                 }
                 else
                 {
                 	LOG_WARN("Cannot set PWM output, it is in AUTO mode.");
                 }
             }
-            PWMNP.s = (allOk) ? IPS_BUSY : IPS_ALERT;
-            if(allOk)
-                IUUpdateNumber(&PWMNP, values, names, n);
+            PWMNP.s = IPS_BUSY;
+            IUUpdateNumber(&PWMNP, values, names, n);
             IDSetNumber(&PWMNP, nullptr);
             IDSetSwitch(&AutoPWMSP, nullptr);
+            for(const auto &command : commands)
+            {
+                queueCommand(command, [this](bool allOk)
+                {
+                    if(!allOk)
+                    {
+                        PWMNP.s = IPS_ALERT;
+                        IDSetNumber(&PWMNP, nullptr);
+                    }
+                }, PWMNP.name);
+            }
             return true;
 		}
         
         // Focuser settings
         if(!strcmp(name, FocuserSettingsNP .name))
         {
-        	bool allOk = true;
-        	std::map<int, std::string> updates;
-            updates[U_SPEED] = doubleToStr(values[FS_SPEED]);
-            updates[U_ACC] = doubleToStr(values[FS_SPEED] * 2.0);
-            updates[U_STEPSIZE] = doubleToStr(values[FS_STEP_SIZE] * 100.0);
-            allOk = allOk && updateSettings("u", "U", updates);
-        	updates.clear();
-            updates[E_COMP_CYCLE] = "30";  // cycle [s]
-            updates[E_COMP_STEPS] = doubleToStr(values[FS_COMPENSATION] * 100.0);
-            updates[E_COMP_SENSR] = "0";   // sensor
-            updates[E_COMP_TRGR] = doubleToStr(values[FS_COMP_THRESHOLD]);
-            allOk = allOk && updateSettings("e", "E", updates);
-        	if(allOk)
-        	{
-                FocuserSettingsNP.s = IPS_BUSY;
-                IUUpdateNumber(&FocuserSettingsNP, values, names, n);
+            startRequest(&FocuserSettingsNP, LAT_SETTINGS);
+            Astrolink4::SettingsPatch<Astrolink4::UFrame> focuserUpdates;
+            focuserUpdates.set<Astrolink4::UField::Speed>(values[FS_SPEED])
+                          .set<Astrolink4::UField::Acceleration>(values[FS_SPEED] * 2.0)
+                          .set<Astrolink4::UField::StepSize>(values[FS_STEP_SIZE]);
+            Astrolink4::SettingsPatch<Astrolink4::EFrame> compUpdates;
+            compUpdates.set<Astrolink4::EField::Cycle>(30)
+                       .set<Astrolink4::EField::Steps>(values[FS_COMPENSATION])
+                       .set<Astrolink4::EField::Sensor>(0)
+                       .set<Astrolink4::EField::Trigger>(values[FS_COMP_THRESHOLD]);
+            FocuserSettingsNP.s = IPS_BUSY;
+            IUUpdateNumber(&FocuserSettingsNP, values, names, n);
+            IDSetNumber(&FocuserSettingsNP, nullptr);
+            queueSettings("ue", [this, focuserUpdates, compUpdates]()
+            {
+                return updateSettings(shadowU, focuserUpdates) && updateSettings(shadowE, compUpdates);
+            }, [this](bool allOk)
+            {
+                if(allOk)
+                {
+                    LOG_INFO(FocuserSettingsN[FS_COMPENSATION].value > 0 ? "Temperature compensation is enabled." : "Temperature compensation is disabled.");
+                    return;
+                }
+                FocuserSettingsNP.s = IPS_ALERT;
                 IDSetNumber(&FocuserSettingsNP, nullptr);
-                LOG_INFO(values[FS_COMPENSATION] > 0 ? "Temperature compensation is enabled." : "Temperature compensation is disabled.");
-                return true;
-        	}
-            FocuserSettingsNP.s = IPS_ALERT;
+            });
             return true;
         }
         
         // Other settings
         if(!strcmp(name, OtherSettingsNP .name))
         {
-        	std::map<int, std::string> updates;
-            updates[N_AREF_COEFF] = doubleToStr(values[SET_AREF_COEFF] * 1000.0);
-            updates[N_OVER_VOLT] = doubleToStr(values[SET_OVER_VOLT] * 10.0);
-            updates[N_OVER_AMP] = doubleToStr(values[SET_OVER_AMP] * 10.0);
-            updates[N_OVER_TIME] = doubleToStr(values[SET_OVER_TIME]);
-            if(updateSettings("n", "N", updates))
-        	{
-                OtherSettingsNP.s = IPS_BUSY;
-                IUUpdateNumber(&OtherSettingsNP, values, names, n);
-                IDSetNumber(&OtherSettingsNP, nullptr);
-                return true;
-        	}
-            OtherSettingsNP.s = IPS_ALERT;
+            startRequest(&OtherSettingsNP, LAT_SETTINGS);
+            Astrolink4::SettingsPatch<Astrolink4::NFrame> updates;
+            updates.set<Astrolink4::NField::ArefCoeff>(values[SET_AREF_COEFF])
+                   .set<Astrolink4::NField::OverVolt>(values[SET_OVER_VOLT])
+                   .set<Astrolink4::NField::OverAmp>(values[SET_OVER_AMP])
+                   .set<Astrolink4::NField::OverTime>(values[SET_OVER_TIME]);
+            OtherSettingsNP.s = IPS_BUSY;
+            IUUpdateNumber(&OtherSettingsNP, values, names, n);
+            IDSetNumber(&OtherSettingsNP, nullptr);
+            queueSettings("n", [this, updates]()
+            {
+                return updateSettings(shadowN, updates);
+            }, [this](bool allOk)
+            {
+                if(!allOk)
+                {
+                    OtherSettingsNP.s = IPS_ALERT;
+                    IDSetNumber(&OtherSettingsNP, nullptr);
+                }
+            });
             return true;
         }
 
@@ -405,19 +1160,26 @@ bool IndiAstrolink4::ISNewNumber (const char *dev, const char *name, double valu
         if(!strcmp(name, DCFocTimeNP.name))
         {
             IUUpdateNumber(&DCFocTimeNP, values, names, n);
-            IDSetNumber(&DCFocTimeNP, nullptr);
+            cancelDcSequence();
             saveConfig(true);
             sprintf(cmd, "G:%d:%.0f:%.0f", (DCFocDirS[0].s == ISS_ON) ? 1 : 0, DCFocTimeN[DC_PWM].value, DCFocTimeN[DC_PERIOD].value);
-            if(sendCommand(cmd, res))
+            DCFocTimeNP.s = IPS_BUSY;
+            IDSetNumber(&DCFocTimeNP, nullptr);
+            focuserMoving = true;
+            pollFocuserSoon();
+            uint32_t aborts = dcAborts;
+            queueCommand(cmd, [this, aborts](bool allOk)
             {
-                DCFocAbortS[0].s = ISS_OFF;
-                DCFocAbortSP.s = IPS_OK;
-                IDSetSwitch(&DCFocAbortSP, nullptr);
-
-                DCFocTimeNP.s = IPS_BUSY;
-                return true;
-            }
-            DCFocTimeNP.s = IPS_ALERT;
+                if(allOk)
+                {
+                    DCFocAbortS[0].s = ISS_OFF;
+                    DCFocAbortSP.s = IPS_OK;
+                    IDSetSwitch(&DCFocAbortSP, nullptr);
+                    return;
+                }
+                DCFocTimeNP.s = dcAborts != aborts ? IPS_IDLE : IPS_ALERT;
+                IDSetNumber(&DCFocTimeNP, nullptr);
+            }, DCFocTimeNP.name);
             return true;
         }
 
@@ -435,70 +1197,265 @@ bool IndiAstrolink4::ISNewSwitch (const char *dev, const char *name, ISState *st
 {
     if (dev && !strcmp(dev, getDeviceName()))
     {
+        Astrolink4::TraceSpan span("ISNewSwitch", "client", name);
+        // load and purge work on the file, pending changes go there first; not under
+        // the lock, the writer reports the result with it held
+        if (!strcmp(name, "CONFIG_PROCESS"))
+            configWriter->flush(configPath);
+        std::lock_guard<std::recursive_mutex> lock(propertyLock);
+        invalidatePublished(name);
         char cmd[ASTROLINK4_LEN] = {0};
-        char res[ASTROLINK4_LEN] = {0};
         
-        // handle power line 1
-		if (!strcmp(name, Power1SP.name))
-		{
-            sprintf(cmd, "C:0:%s", (strcmp(Power1S[0].name, names[0])) ? "0" : "1");
-            bool allOk = sendCommand(cmd, res);
-            Power1SP.s = allOk ? IPS_BUSY : IPS_ALERT;
-            if(allOk)
-                IUUpdateSwitch(&Power1SP, states, names, n);
-            
-            IDSetSwitch(&Power1SP, nullptr);
+        // span tracing
+        if (!strcmp(name, TraceSP.name))
+        {
+            IUUpdateSwitch(&TraceSP, states, names, n);
+            Astrolink4::Tracer::instance().setEnabled(TraceS[TRACE_ON].s == ISS_ON);
+            TraceSP.s = TraceS[TRACE_ON].s == ISS_ON ? IPS_BUSY : IPS_IDLE;
+            IDSetSwitch(&TraceSP, nullptr);
             return true;
-		}
-        
-        // handle power line 2
-        if (!strcmp(name, Power2SP.name))
+        }
+        if (!strcmp(name, TraceActionSP.name))
         {
-            sprintf(cmd, "C:1:%s", (strcmp(Power2S[0].name, names[0])) ? "0" : "1");
-            bool allOk = sendCommand(cmd, res);
-            Power2SP.s = allOk ? IPS_BUSY : IPS_ALERT;
-            if(allOk)
-                IUUpdateSwitch(&Power2SP, states, names, n);
-            
-            IDSetSwitch(&Power2SP, nullptr);
+            IUUpdateSwitch(&TraceActionSP, states, names, n);
+            if(TraceActionS[0].s == ISS_ON)
+            {
+                bool dumped = Astrolink4::Tracer::instance().dump(TraceFileT[0].text);
+                if(dumped)
+                    LOGF_INFO("Trace written to %s", TraceFileT[0].text);
+                else
+                    LOGF_ERROR("Cannot write trace to %s: %s", TraceFileT[0].text, strerror(errno));
+                TraceActionSP.s = dumped ? IPS_OK : IPS_ALERT;
+            }
+            IUResetSwitch(&TraceActionSP);
+            IDSetSwitch(&TraceActionSP, nullptr);
             return true;
         }
-        
-        // handle power line 3
-        if (!strcmp(name, Power3SP.name))
+
+        // serial transcript record / replay
+        if (!strcmp(name, TranscriptSP.name))
         {
-            sprintf(cmd, "C:2:%s", (strcmp(Power3S[0].name, names[0])) ? "0" : "1");
-            bool allOk = sendCommand(cmd, res);
-            Power3SP.s = allOk ? IPS_BUSY : IPS_ALERT;
-            if(allOk)
-                IUUpdateSwitch(&Power3SP, states, names, n);
-            
-            IDSetSwitch(&Power3SP, nullptr);
+            IUUpdateSwitch(&TranscriptSP, states, names, n);
+            transcript.close();
+            replay.stop();
+            TranscriptSP.s = IPS_OK;
+            if(TranscriptS[TRANSCRIPT_RECORD].s == ISS_ON)
+            {
+                if(transcript.open(TranscriptFileT[0].text))
+                {
+                    LOGF_INFO("Recording serial transcript to %s.", TranscriptFileT[0].text);
+                    TranscriptSP.s = IPS_BUSY;
+                }
+                else
+                {
+                    LOGF_ERROR("Cannot write serial transcript %s.", TranscriptFileT[0].text);
+                    TranscriptSP.s = IPS_ALERT;
+                }
+            }
+            else if(TranscriptS[TRANSCRIPT_OFF].s != ISS_ON)
+            {
+                TranscriptSP.s = startReplay(TranscriptS[TRANSCRIPT_REPLAY].s == ISS_ON) ? IPS_BUSY : IPS_ALERT;
+            }
+            if(TranscriptSP.s == IPS_ALERT)
+            {
+                IUResetSwitch(&TranscriptSP);
+                TranscriptS[TRANSCRIPT_OFF].s = ISS_ON;
+            }
+            IDSetSwitch(&TranscriptSP, nullptr);
             return true;
         }
 
-        // compensate now
-        if(!strcmp(name, CompensateNowSP.name))
+        // latency export / reset
+        if (!strcmp(name, LatencyActionSP.name))
         {
-            sprintf(cmd, "S:%d", static_cast<uint8_t>(CompensationValueN[0].value));
-            bool allOk = sendCommand(cmd, res);
-            CompensateNowSP.s = allOk ? IPS_BUSY : IPS_ALERT;
-            if(allOk)
-                IUUpdateSwitch(&CompensateNowSP, states, names, n);
+            IUUpdateSwitch(&LatencyActionSP, states, names, n);
+            if(LatencyActionS[LAT_RESET].s == ISS_ON)
+            {
+                for(auto &histogram : requestLatency)
+                    histogram.reset();
+                LatencyActionSP.s = IPS_OK;
+            }
+            else if(LatencyActionS[LAT_EXPORT].s == ISS_ON)
+            {
+                LatencyActionSP.s = exportLatency(LatencyFileT[0].text) ? IPS_OK : IPS_ALERT;
+            }
+            IUResetSwitch(&LatencyActionSP);
+            IDSetSwitch(&LatencyActionSP, nullptr);
+            return true;
+        }
 
-            IDSetSwitch(&CompensateNowSP, nullptr);
+        // polling pause during camera readout
+        if (!strcmp(name, QuietBusSP.name))
+        {
+            IUUpdateSwitch(&QuietBusSP, states, names, n);
+            QuietBusSP.s = IPS_OK;
+            IDSetSwitch(&QuietBusSP, nullptr);
+            updateQuiet();
             return true;
         }
 
-        // Auto PWM
-        if (!strcmp(name, AutoPWMSP.name))
+        // telemetry archive
+        if (!strcmp(name, ArchiveSP.name))
         {
-            IUUpdateSwitch(&AutoPWMSP, states, names, n);
-            AutoPWMSP.s = (setAutoPWM()) ? IPS_OK : IPS_ALERT;
-            IDSetSwitch(&AutoPWMSP, nullptr);
+            IUUpdateSwitch(&ArchiveSP, states, names, n);
+            configureArchive();
             return true;
         }
-        
+
+        // telemetry history
+        if (!strcmp(name, TelemetryFormatSP.name))
+        {
+            IUUpdateSwitch(&TelemetryFormatSP, states, names, n);
+            TelemetryFormatSP.s = IPS_OK;
+            IDSetSwitch(&TelemetryFormatSP, nullptr);
+            return true;
+        }
+        if (!strcmp(name, TelemetryExportSP.name))
+        {
+            IUUpdateSwitch(&TelemetryExportSP, states, names, n);
+            TelemetryExportSP.s = (TelemetryExportS[0].s != ISS_ON || exportTelemetry()) ? IPS_OK : IPS_ALERT;
+            IUResetSwitch(&TelemetryExportSP);
+            IDSetSwitch(&TelemetryExportSP, nullptr);
+            return true;
+        }
+
+        // handle power line 1
+		if (!strcmp(name, Power1SP.name))
+		{
+            startRequest(&Power1SP, LAT_POWER);
+            sprintf(cmd, "C:0:%s", (strcmp(Power1S[0].name, names[0])) ? "0" : "1");
+            Power1SP.s = IPS_BUSY;
+            IUUpdateSwitch(&Power1SP, states, names, n);
+            IDSetSwitch(&Power1SP, nullptr);
+            queueCommand(cmd, [this](bool allOk)
+            {
+                if(!allOk)
+                {
+                    Power1SP.s = IPS_ALERT;
+                    IDSetSwitch(&Power1SP, nullptr);
+                }
+            });
+            return true;
+		}
+        
+        // handle power line 2
+        if (!strcmp(name, Power2SP.name))
+        {
+            startRequest(&Power2SP, LAT_POWER);
+            sprintf(cmd, "C:1:%s", (strcmp(Power2S[0].name, names[0])) ? "0" : "1");
+            Power2SP.s = IPS_BUSY;
+            IUUpdateSwitch(&Power2SP, states, names, n);
+            IDSetSwitch(&Power2SP, nullptr);
+            queueCommand(cmd, [this](bool allOk)
+            {
+                if(!allOk)
+                {
+                    Power2SP.s = IPS_ALERT;
+                    IDSetSwitch(&Power2SP, nullptr);
+                }
+            });
+            return true;
+        }
+        
+        // handle power line 3
+        if (!strcmp(name, Power3SP.name))
+        {
+            startRequest(&Power3SP, LAT_POWER);
+            sprintf(cmd, "C:2:%s", (strcmp(Power3S[0].name, names[0])) ? "0" : "1");
+            Power3SP.s = IPS_BUSY;
+            IUUpdateSwitch(&Power3SP, states, names, n);
+            IDSetSwitch(&Power3SP, nullptr);
+            queueCommand(cmd, [this](bool allOk)
+            {
+                if(!allOk)
+                {
+                    Power3SP.s = IPS_ALERT;
+                    IDSetSwitch(&Power3SP, nullptr);
+                }
+            });
+            return true;
+        }
+
+        // compensate now
+        if(!strcmp(name, CompensateNowSP.name))
+        {
+            IUUpdateSwitch(&CompensateNowSP, states, names, n);
+            if(DriverCompS[DRIVER_COMP_ON].s == ISS_ON)
+            {
+                // everything owed goes out at once, regardless of the threshold
+                if(focuserBusy())
+                {
+                    LOG_WARN("Focuser is moving, compensation postponed.");
+                    CompensateNowSP.s = IPS_ALERT;
+                }
+                else
+                {
+                    int32_t steps = compensator.release(FocuserSettingsN[FS_COMPENSATION].value, 1);
+                    CompensateNowSP.s = (steps == 0 || compensationMove(steps)) ? IPS_OK : IPS_ALERT;
+                }
+                IDSetSwitch(&CompensateNowSP, nullptr);
+                return true;
+            }
+            sprintf(cmd, "S:%d", static_cast<int>(std::lround(CompensationValueN[0].value)));
+            CompensateNowSP.s = IPS_BUSY;
+            IDSetSwitch(&CompensateNowSP, nullptr);
+            queueCommand(cmd, [this](bool allOk)
+            {
+                if(!allOk)
+                {
+                    CompensateNowSP.s = IPS_ALERT;
+                    IDSetSwitch(&CompensateNowSP, nullptr);
+                }
+            }, CompensateNowSP.name);
+            return true;
+        }
+
+        // driver side compensation
+        if(!strcmp(name, DriverCompSP.name))
+        {
+            IUUpdateSwitch(&DriverCompSP, states, names, n);
+            compensator.reset();
+            DriverCompSP.s = IPS_OK;
+            IDSetSwitch(&DriverCompSP, nullptr);
+            // the firmware must not compensate the same temperature change again
+            if(DriverCompS[DRIVER_COMP_ON].s == ISS_ON && FocuserCompModeS[FS_COMP_AUTO].s == ISS_ON)
+            {
+                Astrolink4::SettingsPatch<Astrolink4::EFrame> updates;
+                updates.set<Astrolink4::EField::Auto>(false);
+                FocuserCompModeSP.s = IPS_BUSY;
+                IDSetSwitch(&FocuserCompModeSP, nullptr);
+                queueSettings("e", [this, updates]()
+                {
+                    return updateSettings(shadowE, updates);
+                }, [this](bool allOk)
+                {
+                    if(!allOk)
+                    {
+                        FocuserCompModeSP.s = IPS_ALERT;
+                        IDSetSwitch(&FocuserCompModeSP, nullptr);
+                    }
+                });
+            }
+            return true;
+        }
+
+        // Auto PWM
+        if (!strcmp(name, AutoPWMSP.name))
+        {
+            IUUpdateSwitch(&AutoPWMSP, states, names, n);
+            AutoPWMSP.s = IPS_BUSY;
+            IDSetSwitch(&AutoPWMSP, nullptr);
+            queueTask([this]()
+            {
+                return setAutoPWM();
+            }, [this](bool allOk)
+            {
+                AutoPWMSP.s = allOk ? IPS_OK : IPS_ALERT;
+                IDSetSwitch(&AutoPWMSP, nullptr);
+            });
+            return true;
+        }
+        
         // DC Focuser
         if (!strcmp(name, DCFocDirSP.name))
         {
@@ -510,95 +1467,142 @@ bool IndiAstrolink4::ISNewSwitch (const char *dev, const char *name, ISState *st
         
         if (!strcmp(name, DCFocAbortSP.name))
         {
-            sprintf(cmd, "%s", "K");
-            if(sendCommand(cmd, res))
+            DCFocAbortSP.s = IPS_BUSY;
+            IUUpdateSwitch(&DCFocAbortSP, states, names, n);
+            IDSetSwitch(&DCFocAbortSP, nullptr);
+            cancelDcSequence();
+            sendAbort("K", [this](bool allOk)
             {
-                DCFocAbortSP.s = IPS_BUSY;
-                IUUpdateSwitch(&DCFocAbortSP, states, names, n);
+                DCFocAbortSP.s = allOk ? IPS_OK : IPS_ALERT;
                 IDSetSwitch(&DCFocAbortSP, nullptr);
-            }
-            DCFocAbortSP.s = IPS_ALERT;
+            });
             return true;
         }
         
         // Power default on
         if(!strcmp(name, PowerDefaultOnSP.name))
         {
-        	std::map<int, std::string> updates;
-            updates[U_OUT1_DEF] = (states[0] == ISS_ON) ? "1" : "0";
-            updates[U_OUT2_DEF] = (states[1] == ISS_ON) ? "1" : "0";
-            updates[U_OUT3_DEF] = (states[2] == ISS_ON) ? "1" : "0";
-            if(updateSettings("u", "U", updates))
-        	{
-                PowerDefaultOnSP.s = IPS_BUSY;
-                IUUpdateSwitch(&PowerDefaultOnSP, states, names, n);
-                IDSetSwitch(&PowerDefaultOnSP, nullptr);
-                return true;
-        	}
-            PowerDefaultOnSP.s = IPS_ALERT;
+            startRequest(&PowerDefaultOnSP, LAT_SETTINGS);
+            Astrolink4::SettingsPatch<Astrolink4::UFrame> updates;
+            updates.set<Astrolink4::UField::Out1Default>(states[0] == ISS_ON)
+                   .set<Astrolink4::UField::Out2Default>(states[1] == ISS_ON)
+                   .set<Astrolink4::UField::Out3Default>(states[2] == ISS_ON);
+            PowerDefaultOnSP.s = IPS_BUSY;
+            IUUpdateSwitch(&PowerDefaultOnSP, states, names, n);
+            IDSetSwitch(&PowerDefaultOnSP, nullptr);
+            queueSettings("u", [this, updates]()
+            {
+                return updateSettings(shadowU, updates);
+            }, [this](bool allOk)
+            {
+                if(!allOk)
+                {
+                    PowerDefaultOnSP.s = IPS_ALERT;
+                    IDSetSwitch(&PowerDefaultOnSP, nullptr);
+                }
+            });
             return true;
         }
 
         // Buzzer
         if(!strcmp(name, BuzzerSP.name))
         {
-            if(updateSettings("j", "J", 1, (states[0] == ISS_ON) ? "1" : "0"))
-        	{
-                BuzzerSP.s = IPS_BUSY;
-                IUUpdateSwitch(&BuzzerSP, states, names, n);
-                IDSetSwitch(&BuzzerSP, nullptr);
-                return true;
-        	}
-            BuzzerSP.s = IPS_ALERT;
+            startRequest(&BuzzerSP, LAT_SETTINGS);
+            Astrolink4::SettingsPatch<Astrolink4::JFrame> updates;
+            updates.set<Astrolink4::JField::Buzzer>(states[0] == ISS_ON);
+            BuzzerSP.s = IPS_BUSY;
+            IUUpdateSwitch(&BuzzerSP, states, names, n);
+            IDSetSwitch(&BuzzerSP, nullptr);
+            queueSettings("j", [this, updates]()
+            {
+                return updateSettings(shadowJ, updates);
+            }, [this](bool allOk)
+            {
+                if(!allOk)
+                {
+                    BuzzerSP.s = IPS_ALERT;
+                    IDSetSwitch(&BuzzerSP, nullptr);
+                }
+            });
             return true;
         }
 
         // Manual mode
         if(!strcmp(name, FocuserManualSP.name))
         {
+            startRequest(&FocuserManualSP, LAT_SETTINGS);
             sprintf(cmd, "F:%s", (strcmp(FocuserManualS[0].name, names[0])) ? "0" : "1");
-            if(sendCommand(cmd, res))
-        	{
-            	FocuserManualSP.s = IPS_BUSY;
-                IUUpdateSwitch(&FocuserManualSP, states, names, n);
-                IDSetSwitch(&FocuserManualSP, nullptr);
-                return true;
-        	}
-            FocuserManualSP.s = IPS_ALERT;
+            FocuserManualSP.s = IPS_BUSY;
+            IUUpdateSwitch(&FocuserManualSP, states, names, n);
+            IDSetSwitch(&FocuserManualSP, nullptr);
+            holdSettings("f", 1);
+            queueCommand(cmd, [this](bool allOk)
+            {
+                holdSettings("f", -1);
+                if(!allOk)
+                {
+                    FocuserManualSP.s = IPS_ALERT;
+                    IDSetSwitch(&FocuserManualSP, nullptr);
+                }
+            });
             return true;
         }
         
         // Focuser Mode
         if(!strcmp(name, FocuserModeSP.name))
         {
-            std::string value = "0";
-            if(!strcmp(FocuserModeS[FS_MODE_UNI].name, names[0])) value = "0";
-            if(!strcmp(FocuserModeS[FS_MODE_BI].name, names[0])) value = "1";
-            if(!strcmp(FocuserModeS[FS_MODE_MICRO].name, names[0])) value = "2";
-            if(updateSettings("u", "U", U_STEPPER_MODE, value.c_str()))
-        	{
-                FocuserModeSP.s = IPS_BUSY;
-                IUUpdateSwitch(&FocuserModeSP, states, names, n);
-                IDSetSwitch(&FocuserModeSP, nullptr);
-                return true;
-        	}
-            FocuserModeSP.s = IPS_ALERT;
+            startRequest(&FocuserModeSP, LAT_SETTINGS);
+            long mode = 0;
+            if(!strcmp(FocuserModeS[FS_MODE_UNI].name, names[0])) mode = 0;
+            if(!strcmp(FocuserModeS[FS_MODE_BI].name, names[0])) mode = 1;
+            if(!strcmp(FocuserModeS[FS_MODE_MICRO].name, names[0])) mode = 2;
+            Astrolink4::SettingsPatch<Astrolink4::UFrame> updates;
+            updates.set<Astrolink4::UField::StepperMode>(mode);
+            FocuserModeSP.s = IPS_BUSY;
+            IUUpdateSwitch(&FocuserModeSP, states, names, n);
+            IDSetSwitch(&FocuserModeSP, nullptr);
+            queueSettings("u", [this, updates]()
+            {
+                return updateSettings(shadowU, updates);
+            }, [this](bool allOk)
+            {
+                if(!allOk)
+                {
+                    FocuserModeSP.s = IPS_ALERT;
+                    IDSetSwitch(&FocuserModeSP, nullptr);
+                }
+            });
             return true;
         }
 
         // Focuser compensation mode
         if(!strcmp(name, FocuserCompModeSP.name))
         {
-        	std::string value = "0";
-        	if(!strcmp(FocuserCompModeS[FS_COMP_AUTO].name, names[0])) value = "1";
-        	if(updateSettings("e", "E", E_COMP_AUTO, value.c_str()))
-        	{
-        		FocuserCompModeSP.s = IPS_BUSY;
-                IUUpdateSwitch(&FocuserCompModeSP, states, names, n);
-                IDSetSwitch(&FocuserCompModeSP, nullptr);
-                return true;
-        	}
-        	FocuserCompModeSP.s = IPS_ALERT;
+            startRequest(&FocuserCompModeSP, LAT_SETTINGS);
+            bool automatic = !strcmp(FocuserCompModeS[FS_COMP_AUTO].name, names[0]);
+            Astrolink4::SettingsPatch<Astrolink4::EFrame> updates;
+            updates.set<Astrolink4::EField::Auto>(automatic);
+            if(automatic && DriverCompS[DRIVER_COMP_ON].s == ISS_ON)
+            {
+                LOG_INFO("Firmware compensation selected, driver compensation is disabled.");
+                DriverCompS[DRIVER_COMP_ON].s = ISS_OFF;
+                DriverCompS[DRIVER_COMP_OFF].s = ISS_ON;
+                IDSetSwitch(&DriverCompSP, nullptr);
+            }
+            FocuserCompModeSP.s = IPS_BUSY;
+            IUUpdateSwitch(&FocuserCompModeSP, states, names, n);
+            IDSetSwitch(&FocuserCompModeSP, nullptr);
+            queueSettings("e", [this, updates]()
+            {
+                return updateSettings(shadowE, updates);
+            }, [this](bool allOk)
+            {
+                if(!allOk)
+                {
+                    FocuserCompModeSP.s = IPS_ALERT;
+                    IDSetSwitch(&FocuserCompModeSP, nullptr);
+                }
+            });
             return true;
         }
 
@@ -606,6 +1610,7 @@ bool IndiAstrolink4::ISNewSwitch (const char *dev, const char *name, ISState *st
             return FI::processSwitch(dev, name, states, names, n);
         if (strstr(name, "WEATHER_")) 
             return WI::processSwitch(dev, name, states, names, n);
+
 	}
 
 	return INDI::DefaultDevice::ISNewSwitch (dev, name, states, names, n);
@@ -615,6 +1620,74 @@ bool IndiAstrolink4::ISNewText(const char * dev, const char * name, char * texts
 {
     if (dev && !strcmp(dev, getDeviceName()))
     {
+        Astrolink4::TraceSpan span("ISNewText", "client", name);
+        std::lock_guard<std::recursive_mutex> lock(propertyLock);
+        // telemetry archive file
+        if (!strcmp(name, ArchiveFileTP.name))
+        {
+            IUUpdateText(&ArchiveFileTP, texts, names, n);
+            ArchiveFileTP.s = IPS_OK;
+            IDSetText(&ArchiveFileTP, nullptr);
+            configureArchive();
+            return true;
+        }
+
+        // snooped camera
+        if (!strcmp(name, ActiveDeviceTP.name))
+        {
+            IUUpdateText(&ActiveDeviceTP, texts, names, n);
+            ActiveDeviceTP.s = IPS_OK;
+            IDSetText(&ActiveDeviceTP, nullptr);
+            strncpy(CcdExposureNP.device, ActiveDeviceT[0].text, MAXINDIDEVICE - 1);
+            CcdExposureNP.s = IPS_IDLE;
+            IDSnoopDevice(ActiveDeviceT[0].text, "CCD_EXPOSURE");
+            updateQuiet();
+            return true;
+        }
+
+        // trace dump file
+        if (!strcmp(name, TraceFileTP.name))
+        {
+            IUUpdateText(&TraceFileTP, texts, names, n);
+            TraceFileTP.s = IPS_OK;
+            IDSetText(&TraceFileTP, nullptr);
+            return true;
+        }
+
+        // serial transcript file
+        if (!strcmp(name, TranscriptFileTP.name))
+        {
+            IUUpdateText(&TranscriptFileTP, texts, names, n);
+            TranscriptFileTP.s = IPS_OK;
+            IDSetText(&TranscriptFileTP, nullptr);
+            return true;
+        }
+
+        // Latency export file
+        if (!strcmp(name, LatencyFileTP.name))
+        {
+            IUUpdateText(&LatencyFileTP, texts, names, n);
+            LatencyFileTP.s = IPS_OK;
+            IDSetText(&LatencyFileTP, nullptr);
+            return true;
+        }
+
+        // DC focuser pulse sequence
+        if (!strcmp(name, DCFocSequenceTP.name))
+        {
+            IUUpdateText(&DCFocSequenceTP, texts, names, n);
+            std::vector<DcPulse> pulses;
+            if(!parseDcSequence(DCFocSequenceT[0].text, pulses))
+            {
+                LOG_ERROR("DC focuser sequence must be dir:pwm:ms pulses within the DC focuser limits, e.g. IN:50:200 OUT:40:100.");
+                DCFocSequenceTP.s = IPS_ALERT;
+                IDSetText(&DCFocSequenceTP, nullptr);
+                return true;
+            }
+            startDcSequence(pulses);
+            return true;
+        }
+
         // Power Labels
         if (!strcmp(name, PowerControlsLabelsTP.name))
         {
@@ -629,6 +1702,69 @@ bool IndiAstrolink4::ISNewText(const char * dev, const char * name, char * texts
     return INDI::DefaultDevice::ISNewText(dev, name, texts, names, n);
 }
 
+bool IndiAstrolink4::ISSnoopDevice(XMLEle *root)
+{
+    // matches only the CCD_EXPOSURE property of the configured camera
+    if (IUSnoopNumber(root, &CcdExposureNP) == 0)
+    {
+        std::lock_guard<std::recursive_mutex> lock(propertyLock);
+        updateQuiet();
+    }
+    return INDI::DefaultDevice::ISSnoopDevice(root);
+}
+
+
+bool IndiAstrolink4::saveConfig(bool silent, const char *property)
+{
+    // the whole file is rewritten, one property would need a read-modify-write of it anyway
+    char *buffer = nullptr;
+    size_t size = 0;
+    FILE *fp = open_memstream(&buffer, &size);
+    if(fp == nullptr)
+        return INDI::DefaultDevice::saveConfig(silent, property);
+    {
+        std::lock_guard<std::recursive_mutex> lock(propertyLock);
+        IUSaveConfigTag(fp, 0, getDeviceName(), 1);
+        saveConfigItems(fp);
+        IUSaveConfigTag(fp, 1, getDeviceName(), 1);
+    }
+    fclose(fp);
+    configWriter->submit(configPath, std::string(buffer, size), !silent, [this](bool ok, const std::string &path, bool announce)
+    {
+        int error = errno;
+        // the writer thread shares the driver output and the properties with the event loop
+        std::lock_guard<std::recursive_mutex> lock(propertyLock);
+        if(!ok)
+        {
+            LOGF_ERROR("Cannot save configuration to %s: %s", path.c_str(), strerror(error));
+            return;
+        }
+        // like DefaultDevice::saveConfig, the first complete file also becomes the default one
+        if(!defaultConfigSaved)
+        {
+            IUSaveDefaultConfig(nullptr, nullptr, getDeviceName());
+            defaultConfigSaved = true;
+        }
+        if(announce)
+            LOG_INFO("Configuration successfully saved.");
+    });
+    free(buffer);
+    return true;
+}
+
+void IndiAstrolink4::resolveConfigPath()
+{
+    // the file IUGetConfigFP opens for this device, its directory is created the same way
+    const char *home = getenv("HOME");
+    std::string dir = std::string(home ? home : "/tmp") + "/.indi/";
+    if(const char *config = getenv("INDICONFIG"))
+        configPath = config;
+    else
+        configPath = dir + getDeviceName() + "_config.xml";
+    struct stat st;
+    if(stat(dir.c_str(), &st) != 0)
+        mkdir(dir.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+}
 
 bool IndiAstrolink4::saveConfigItems(FILE *fp)
 {
@@ -638,6 +1774,21 @@ bool IndiAstrolink4::saveConfigItems(FILE *fp)
     IUSaveConfigNumber(fp, &DCFocTimeNP);
     IUSaveConfigSwitch(fp, &DCFocDirSP);
     IUSaveConfigText(fp, &PowerControlsLabelsTP);
+    IUSaveConfigNumber(fp, &PublishDeadbandNP);
+    IUSaveConfigNumber(fp, &PollRatesNP);
+    IUSaveConfigText(fp, &ActiveDeviceTP);
+    IUSaveConfigSwitch(fp, &QuietBusSP);
+    IUSaveConfigNumber(fp, &QuietNP);
+    IUSaveConfigSwitch(fp, &DriverCompSP);
+    IUSaveConfigNumber(fp, &CompFilterNP);
+    IUSaveConfigText(fp, &LatencyFileTP);
+    IUSaveConfigText(fp, &TraceFileTP);
+    IUSaveConfigText(fp, &TranscriptFileTP);
+    IUSaveConfigNumber(fp, &TelemetryRangeNP);
+    IUSaveConfigSwitch(fp, &TelemetryFormatSP);
+    IUSaveConfigText(fp, &ArchiveFileTP);
+    IUSaveConfigNumber(fp, &ArchiveLimitsNP);
+    IUSaveConfigSwitch(fp, &ArchiveSP);
     return true;
 }
 
@@ -647,17 +1798,21 @@ bool IndiAstrolink4::saveConfigItems(FILE *fp)
 bool IndiAstrolink4::setAutoPWM()
 {
     char cmd[ASTROLINK4_LEN] = {0}, res[ASTROLINK4_LEN] = {0};
-    bool allOk = true;
-
-    uint8_t valA = (AutoPWMS[0].s == ISS_ON) ? 255 : static_cast<uint8_t>(PWMN[0].value);
-    uint8_t valB = (AutoPWMS[1].s == ISS_ON) ? 255 : static_cast<uint8_t>(PWMN[1].value);
+    uint8_t valA, valB;
+    {
+        std::lock_guard<std::recursive_mutex> lock(propertyLock);
+        valA = (AutoPWMS[0].s == ISS_ON) ? 255 : static_cast<uint8_t>(PWMN[0].value);
+        valB = (AutoPWMS[1].s == ISS_ON) ? 255 : static_cast<uint8_t>(PWMN[1].value);
+    }
 
+    char cmdB[ASTROLINK4_LEN] = {0}, resB[ASTROLINK4_LEN] = {0};
     snprintf(cmd, ASTROLINK4_LEN, "B:0:%d", valA);
-    allOk = allOk && sendCommand(cmd, res);
-    snprintf(cmd, ASTROLINK4_LEN, "B:1:%d", valB);
-    allOk = allOk && sendCommand(cmd, res);
+    snprintf(cmdB, ASTROLINK4_LEN, "B:1:%d", valB);
 
-    return allOk;
+    const char *cmds[] = { cmd, cmdB };
+    char *replies[] = { res, resB };
+    bool ok[2];
+    return sendCommands(cmds, replies, ok, 2);
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -665,25 +1820,355 @@ bool IndiAstrolink4::setAutoPWM()
 //////////////////////////////////////////////////////////////////////
 IPState IndiAstrolink4::MoveAbsFocuser(uint32_t targetTicks)
 {
+    return startMove(targetTicks, true);
+}
+
+IPState IndiAstrolink4::startMove(uint32_t targetTicks, bool client)
+{
+    std::lock_guard<std::recursive_mutex> lock(propertyLock);
+    transcript.record(Astrolink4::TranscriptEntry::MOVE, targetTicks);
 	int32_t backlash = 0;
-	if(backlashEnabled)
+	if(backlashEnabled && backlashSteps != 0)
 	{
 		if((targetTicks > FocusAbsPosNP[0].getValue()) == (backlashSteps > 0))
 		{
-			if((targetTicks + backlash) < 0 || (targetTicks + backlash) > FocusAbsPosNP[0].getValue())
-			{
-				backlash = 0;
-			}
-			else
-			{
+			// overshoot only when it stays within the travel range
+			int64_t overshoot = static_cast<int64_t>(targetTicks) + backlashSteps;
+			if(overshoot >= 0 && overshoot <= FocusMaxPosNP[0].getValue())
 				backlash = backlashSteps;
-				requireBacklashReturn = true;
-			}
 		}
 	}
-    char cmd[ASTROLINK4_LEN] = {0}, res[ASTROLINK4_LEN] = {0};
-    snprintf(cmd, ASTROLINK4_LEN, "R:0:%u", targetTicks + backlash);
-    return (sendCommand(cmd, res)) ? IPS_BUSY : IPS_ALERT;
+
+    uint32_t move = ++backlashMove;
+    uint32_t queued = ++movesQueued;
+    backlashPhase = backlash ? BACKLASH_OVERSHOOT : BACKLASH_NONE;
+    backlashTarget = targetTicks;
+    focuserTarget = targetTicks + backlash;
+    char cmd[ASTROLINK4_LEN] = {0};
+    snprintf(cmd, ASTROLINK4_LEN, "R:0:%u", focuserTarget);
+    focuserMoving = true;
+    trackPosition = true;
+    fullFrameDue = false;
+    pollFocuserSoon();
+    // compensation moves are not client requests, they stay out of the move latency
+    if(client)
+        startRequest(&FocusAbsPosNP, LAT_MOVE);
+    queueCommand(cmd, [this, move, queued](bool allOk)
+    {
+        // written, failed or dropped, polls from here on were requested after it
+        movesAcked = queued;
+        // dropped by an abort or superseded by a newer move
+        if(backlashMove != move)
+            return;
+        if(!allOk)
+        {
+            backlashPhase = BACKLASH_NONE;
+            FocusAbsPosNP.setState(IPS_ALERT);
+            FocusAbsPosNP.apply();
+            return;
+        }
+        if(backlashPhase == BACKLASH_OVERSHOOT && backlashMove == move)
+            worker.postAfter(std::chrono::milliseconds(ASTROLINK4_BACKLASH_POLL), [this, move]()
+        {
+            watchBacklash(move);
+        });
+    }, FocusAbsPosNP.getName());
+    return IPS_BUSY;
+}
+
+void IndiAstrolink4::compensate(const Astrolink4::QFrame &frame)
+{
+    // sensor 1 first, the firmware compensation uses it as well
+    double temperature;
+    if(frame.sens1Type > 0)
+        temperature = frame.sens1Temp;
+    else if(frame.sens2Type > 0)
+        temperature = frame.sens2Temp;
+    else
+        return;
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    double dt = compensator.isValid() ? std::chrono::duration<double>(now - compensatorSampleAt).count() : 0;
+    compensatorSampleAt = now;
+    compensator.update(temperature, dt, CompFilterN[0].value);
+
+    // a move in progress is never interrupted, the steps owed keep accumulating until it ends
+    double stepsPerDegree = FocuserSettingsN[FS_COMPENSATION].value;
+    if(!focuserBusy())
+    {
+        int32_t steps = compensator.release(stepsPerDegree, FocuserSettingsN[FS_COMP_THRESHOLD].value);
+        if(steps != 0)
+            compensationMove(steps);
+    }
+    CompensationValueN[0].value = compensator.pending(stepsPerDegree);
+}
+
+bool IndiAstrolink4::focuserBusy()
+{
+    std::lock_guard<std::recursive_mutex> lock(propertyLock);
+    return focuserMoving || backlashPhase != BACKLASH_NONE || FocusAbsPosNP.getState() == IPS_BUSY;
+}
+
+bool IndiAstrolink4::compensationMove(int32_t steps)
+{
+    std::lock_guard<std::recursive_mutex> lock(propertyLock);
+    // recorded moves already include the compensation moves of the capture
+    if(replay.isActive())
+        return true;
+    // absolute move, unlike 'S' it is not limited to a byte and stays within the travel range
+    int64_t position = static_cast<int64_t>(FocusAbsPosNP[0].getValue());
+    int64_t target = std::max<int64_t>(0, std::min<int64_t>(position + steps, FocusMaxPosNP[0].getValue()));
+    if(target == position)
+        return true;
+    LOGF_INFO("Temperature compensation: moving %d steps.", static_cast<int>(target - position));
+    FocusAbsPosNP.setState(IPS_BUSY);
+    FocusAbsPosNP.apply();
+    return startMove(static_cast<uint32_t>(target), false) != IPS_ALERT;
+}
+
+void IndiAstrolink4::watchBacklash(uint32_t move, bool confirm)
+{
+    // the position alone is enough while it changes, a full frame confirms a stop short of the target
+    char res[ASTROLINK4_LEN] = {0};
+    Astrolink4::QFrame frame;
+    int32_t position = 0;
+    bool frameOk;
+    if(confirm)
+    {
+        frameOk = sendCommand("q", res) && Astrolink4::decodeQFrame(res, frame);
+        position = frame.stepperPos;
+    }
+    else
+        frameOk = sendCommand("p", res) && Astrolink4::decodePFrame(res, position);
+
+    // the next read is a delayed job, other queued requests run in the meantime
+    auto again = [this, move](bool confirm)
+    {
+        worker.postAfter(std::chrono::milliseconds(ASTROLINK4_BACKLASH_POLL), [this, move, confirm]()
+        {
+            watchBacklash(move, confirm);
+        });
+    };
+    auto fail = [this]()
+    {
+        backlashPhase = BACKLASH_NONE;
+        FocusAbsPosNP.setState(IPS_ALERT);
+        FocusAbsPosNP.apply();
+    };
+
+    uint32_t target, aborts;
+    {
+        std::lock_guard<std::recursive_mutex> lock(propertyLock);
+        if(backlashMove != move || backlashPhase != BACKLASH_OVERSHOOT)
+            return;
+        // AbortFocuser bumps backlashMove before the abort counter, read together they cannot miss it
+        aborts = stepperAborts;
+        if(!frameOk)
+        {
+            if(linkLost)
+                fail();
+            else
+                again(false);
+            return;
+        }
+        bool stopped = position == FocusAbsPosNP[0].getValue();
+        FocusAbsPosNP[0].setValue(position);
+        FocusPosMMN[0].value = position * FocuserSettingsN[FS_STEP_SIZE].value / 1000.0;
+        publishFocuser(FocusAbsPosNP);
+        bool reached = confirm ? frame.stepsToGo == 0 : position == static_cast<int32_t>(focuserTarget);
+        if(!reached)
+        {
+            again(!confirm && stopped);
+            return;
+        }
+        target = backlashTarget;
+    }
+
+    // overshoot reached, the return leg goes out right away
+    char cmd[ASTROLINK4_LEN] = {0};
+    snprintf(cmd, ASTROLINK4_LEN, "R:0:%u", target);
+    const char *cmds[] = { cmd };
+    char *replies[] = { res };
+    bool sent = false;
+    sendCommands(cmds, replies, &sent, 1, &aborts);
+
+    std::lock_guard<std::recursive_mutex> lock(propertyLock);
+    if(backlashMove != move)
+        return;
+    if(!sent)
+    {
+        fail();
+        return;
+    }
+    backlashPhase = BACKLASH_RETURN;
+    focuserTarget = target;
+}
+
+bool IndiAstrolink4::parseDcSequence(const char *text, std::vector<DcPulse> &pulses)
+{
+    // "IN:50:200 OUT:40:100", separated by spaces, commas or semicolons; 1/0 work as in the G command
+    pulses.clear();
+    std::string list(text);
+    std::replace(list.begin(), list.end(), ',', ' ');
+    std::replace(list.begin(), list.end(), ';', ' ');
+    std::istringstream items(list);
+    std::string item;
+    while(items >> item)
+    {
+        char dir[8] = {0};
+        double pwm, period;
+        if(sscanf(item.c_str(), "%7[^:]:%lf:%lf", dir, &pwm, &period) != 3)
+            return false;
+        DcPulse pulse;
+        if(!strcasecmp(dir, "IN") || !strcmp(dir, "1"))
+            pulse.inward = true;
+        else if(!strcasecmp(dir, "OUT") || !strcmp(dir, "0"))
+            pulse.inward = false;
+        else
+            return false;
+        if(pwm < DCFocTimeN[DC_PWM].min || pwm > DCFocTimeN[DC_PWM].max ||
+                period < DCFocTimeN[DC_PERIOD].min || period > DCFocTimeN[DC_PERIOD].max)
+            return false;
+        pulse.pwm = static_cast<int>(std::lround(pwm));
+        pulse.periodMs = static_cast<int>(std::lround(period));
+        pulses.push_back(pulse);
+    }
+    return !pulses.empty() && pulses.size() <= ASTROLINK4_DC_SEQUENCE_MAX;
+}
+
+void IndiAstrolink4::startDcSequence(const std::vector<DcPulse> &pulses)
+{
+    std::lock_guard<std::recursive_mutex> lock(propertyLock);
+    dcSequence = pulses;
+    dcSequenceActive = true;
+    uint32_t run = ++dcSequenceRun;
+    uint32_t aborts = dcAborts;
+    focuserMoving = true;
+    pollFocuserSoon();
+    DCFocSequenceTP.s = IPS_BUSY;
+    IDSetText(&DCFocSequenceTP, nullptr);
+    bool posted = worker.post([this, run, aborts]()
+    {
+        startDcPulse(run, aborts, 0);
+    });
+    if(!posted)
+        finishDcSequence(run, IPS_ALERT);
+}
+
+void IndiAstrolink4::cancelDcSequence()
+{
+    std::lock_guard<std::recursive_mutex> lock(propertyLock);
+    if(!dcSequenceActive)
+        return;
+    dcSequenceRun++;
+    dcSequenceActive = false;
+    DCFocSequenceTP.s = IPS_IDLE;
+    IDSetText(&DCFocSequenceTP, nullptr);
+}
+
+void IndiAstrolink4::finishDcSequence(uint32_t run, IPState state)
+{
+    std::lock_guard<std::recursive_mutex> lock(propertyLock);
+    if(run != dcSequenceRun || !dcSequenceActive)
+        return;
+    dcSequenceActive = false;
+    DCFocSequenceTP.s = state;
+    IDSetText(&DCFocSequenceTP, nullptr);
+}
+
+void IndiAstrolink4::startDcPulse(uint32_t run, uint32_t aborts, size_t index)
+{
+    char cmd[ASTROLINK4_LEN] = {0};
+    int periodMs;
+    {
+        std::lock_guard<std::recursive_mutex> lock(propertyLock);
+        if(run != dcSequenceRun || index >= dcSequence.size())
+            return;
+        // sent from the sequence itself, the manual direction and pulse settings are saved with the config
+        const DcPulse &pulse = dcSequence[index];
+        IDSetText(&DCFocSequenceTP, "DC focuser pulse %u of %u", static_cast<unsigned>(index + 1),
+                  static_cast<unsigned>(dcSequence.size()));
+        snprintf(cmd, ASTROLINK4_LEN, "G:%d:%d:%d", pulse.inward ? 1 : 0, pulse.pwm, pulse.periodMs);
+        periodMs = pulse.periodMs;
+    }
+
+    char res[ASTROLINK4_LEN] = {0};
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + std::chrono::milliseconds(periodMs);
+    const char *cmds[] = { cmd };
+    char *replies[] = { res };
+    bool sent = false;
+    sendCommands(cmds, replies, &sent, 1, &aborts);
+    if(!sent)
+    {
+        // a pulse dropped for a stop belongs to a sequence the stop already ended
+        finishDcSequence(run, IPS_ALERT);
+        return;
+    }
+    // first look when the pulse time is over, the firmware cannot be done before
+    worker.postAfter(std::chrono::milliseconds(periodMs), [this, run, aborts, index, end]()
+    {
+        watchDcPulse(run, aborts, index, end);
+    });
+}
+
+void IndiAstrolink4::watchDcPulse(uint32_t run, uint32_t aborts, size_t index, std::chrono::steady_clock::time_point end)
+{
+    // checks are delayed jobs, other queued requests run in between
+    auto again = [this, run, aborts, index, end]()
+    {
+        worker.postAfter(std::chrono::milliseconds(ASTROLINK4_DC_SEQUENCE_POLL), [this, run, aborts, index, end]()
+        {
+            watchDcPulse(run, aborts, index, end);
+        });
+    };
+    {
+        std::lock_guard<std::recursive_mutex> lock(propertyLock);
+        if(run != dcSequenceRun)
+            return;
+    }
+    // the firmware cannot be done before the pulse time is over
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if(now < end)
+    {
+        again();
+        return;
+    }
+
+    char res[ASTROLINK4_LEN] = {0};
+    Astrolink4::QFrame frame;
+    bool frameOk = sendCommand("q", res) && Astrolink4::decodeQFrame(res, frame);
+
+    {
+        std::lock_guard<std::recursive_mutex> lock(propertyLock);
+        if(run != dcSequenceRun)
+            return;
+        if(!frameOk)
+        {
+            if(linkLost)
+                finishDcSequence(run, IPS_ALERT);
+            else
+                again();
+            return;
+        }
+        if(frame.dcMove)
+        {
+            if(now - end < std::chrono::milliseconds(ASTROLINK4_DC_PULSE_TIMEOUT))
+                again();
+            else
+            {
+                LOG_ERROR("DC focuser pulse did not end in time, sequence stopped.");
+                finishDcSequence(run, IPS_ALERT);
+            }
+            return;
+        }
+        if(index + 1 >= dcSequence.size())
+        {
+            finishDcSequence(run, IPS_OK);
+            return;
+        }
+    }
+    // the next pulse goes out right away, not behind the queue
+    startDcPulse(run, aborts, index + 1);
 }
 
 IPState IndiAstrolink4::MoveRelFocuser(FocusDirection dir, uint32_t ticks)
@@ -693,33 +2178,128 @@ IPState IndiAstrolink4::MoveRelFocuser(FocusDirection dir, uint32_t ticks)
 
 bool IndiAstrolink4::AbortFocuser()
 {
-    char res[ASTROLINK4_LEN] = {0};
-    return (sendCommand("H", res));
+    transcript.record(Astrolink4::TranscriptEntry::ABORT, 0u);
+    {
+        std::lock_guard<std::recursive_mutex> lock(propertyLock);
+        backlashMove++;
+        backlashPhase = BACKLASH_NONE;
+    }
+    sendAbort("H", [this](bool allOk)
+    {
+        if(!allOk)
+            LOG_ERROR("Focuser abort failed.");
+    });
+    return true;
+}
+
+std::atomic<uint32_t> *IndiAstrolink4::abortsFor(char letter)
+{
+    switch(letter)
+    {
+        case 'H':
+        case 'R':
+        case 'S':
+            return &stepperAborts;
+        case 'K':
+        case 'G':
+            return &dcAborts;
+        default:
+            return nullptr;
+    }
+}
+
+std::atomic<uint32_t> *IndiAstrolink4::moveAbortsFor(const char *cmd)
+{
+    return cmd[0] == 'H' || cmd[0] == 'K' ? nullptr : abortsFor(cmd[0]);
+}
+
+void IndiAstrolink4::sendAbort(const char *cmd, std::function<void(bool)> done)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    ++*abortsFor(cmd[0]);
+
+    // simulation and replay have no port to race with, the queue keeps them deterministic
+    if(isSimulation())
+    {
+        queueCommand(cmd, done);
+        return;
+    }
+
+    // written between two bursts at worst, the reader serializes writers
+    char line[ASTROLINK4_LEN];
+    size_t len = snprintf(line, sizeof(line), "%s\n", cmd);
+    pendingAbortAcks++;
+    LOGF_DEBUG("CMD %s", line);
+    bool ok = writeBurst(line, len);
+    // its ack is recorded by whichever burst reads it
+    transcript.flush();
+    if(!ok)
+    {
+        pendingAbortAcks--;
+        LOGF_ERROR("Serial error: %s", strerror(errno));
+    }
+
+    std::lock_guard<std::recursive_mutex> lock(propertyLock);
+    abortWire.record(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    if(done)
+        done(ok);
+}
+
+bool IndiAstrolink4::abortAck(const char *line)
+{
+    if(line[0] != 'H' && line[0] != 'K')
+        return false;
+    int pending = pendingAbortAcks;
+    while(pending > 0)
+        if(pendingAbortAcks.compare_exchange_weak(pending, pending - 1))
+            return true;
+    return false;
 }
 
 bool IndiAstrolink4::ReverseFocuser(bool enabled)
 {
-    return updateSettings("u", "U", U_REVERSED, (enabled) ? "1" : "0");
+    Astrolink4::SettingsPatch<Astrolink4::UFrame> updates;
+    updates.set<Astrolink4::UField::Reversed>(enabled);
+    queueSettings("u", [this, updates]()
+    {
+        return updateSettings(shadowU, updates);
+    }, [this](bool allOk)
+    {
+        if(!allOk)
+            LOG_ERROR("Focuser reverse setting failed.");
+    });
+    return true;
 }
 
 bool IndiAstrolink4::SyncFocuser(uint32_t ticks)
 {
-    char cmd[ASTROLINK4_LEN] = {0}, res[ASTROLINK4_LEN] = {0};
+    char cmd[ASTROLINK4_LEN] = {0};
     snprintf(cmd, ASTROLINK4_LEN, "P:0:%u", ticks);
-    return sendCommand(cmd, res);
+    queueCommand(cmd, [this](bool allOk)
+    {
+        if(!allOk)
+            LOG_ERROR("Focuser sync failed.");
+    }, FocusAbsPosNP.getName());
+    return true;
 }
 
 bool IndiAstrolink4::SetFocuserMaxPosition(uint32_t ticks)
 {
-    if(updateSettings("u", "U", U_MAX_POS, std::to_string(ticks).c_str()))
+    FocuserSettingsNP.s = IPS_BUSY;
+    Astrolink4::SettingsPatch<Astrolink4::UFrame> updates;
+    updates.set<Astrolink4::UField::MaxPos>(ticks);
+    queueSettings("u", [this, updates]()
     {
-        FocuserSettingsNP.s = IPS_BUSY;
-        return true;
-    }
-    else
+        return updateSettings(shadowU, updates);
+    }, [this](bool allOk)
     {
-        return false;
-    }
+        if(!allOk)
+        {
+            FocuserSettingsNP.s = IPS_ALERT;
+            IDSetNumber(&FocuserSettingsNP, nullptr);
+        }
+    });
+    return true;
 }
 
 bool IndiAstrolink4::SetFocuserBacklash(int32_t steps)
@@ -739,9 +2319,6 @@ bool IndiAstrolink4::SetFocuserBacklashEnabled(bool enabled)
 //////////////////////////////////////////////////////////////////////
 bool IndiAstrolink4::sendCommand(const char * cmd, char * res)
 {
-    int nbytes_read = 0, nbytes_written = 0, tty_rc = 0;
-    char command[ASTROLINK4_LEN];
-
     if(isSimulation())
     {
         if(strcmp(cmd, "#") == 0) sprintf(res, "%s\n", "#:AstroLink4mini");
@@ -751,6 +2328,8 @@ bool IndiAstrolink4::sendCommand(const char * cmd, char * res)
         if(strcmp(cmd, "n") == 0) sprintf(res, "%s\n", "n:1077:14.0:10.0:100");
         if(strcmp(cmd, "e") == 0) sprintf(res, "%s\n", "e:30:1200:1:0:20");
         if(strcmp(cmd, "u") == 0) sprintf(res, "%s\n", "u:25000:220:0:100:440:0:0:1:257:0:0:0:0:0:1:0:0");
+        if(strcmp(cmd, "j") == 0) sprintf(res, "%s\n", "j:1");
+        if(strcmp(cmd, "f") == 0) sprintf(res, "%s\n", "f:0");
         if(strncmp(cmd, "R", 1) == 0) sprintf(res, "%s\n", "R:");
         if(strncmp(cmd, "C", 1) == 0) sprintf(res, "%s\n", "C:");
         if(strncmp(cmd, "B", 1) == 0) sprintf(res, "%s\n", "B:");
@@ -762,63 +2341,464 @@ bool IndiAstrolink4::sendCommand(const char * cmd, char * res)
         if(strncmp(cmd, "K", 1) == 0) sprintf(res, "%s\n", "K:");
         if(strncmp(cmd, "N", 1) == 0) sprintf(res, "%s\n", "N:");
         if(strncmp(cmd, "E", 1) == 0) sprintf(res, "%s\n", "E:");
+        if(strncmp(cmd, "J", 1) == 0) sprintf(res, "%s\n", "J:");
+        if(strncmp(cmd, "F", 1) == 0) sprintf(res, "%s\n", "F:");
+        res[strcspn(res, "\n")] = '\0';
     }
     else
     {
-        tcflush(PortFD, TCIOFLUSH);
-        sprintf(command, "%s\n", cmd);
-        LOGF_DEBUG("CMD %s", command);
-        if ( (tty_rc = tty_write_string(PortFD, command, &nbytes_written)) != TTY_OK)
-            return false;
+        char reply[ASTROLINK4_LEN] = {0};
+        const char *cmds[] = { cmd };
+        char *replies[] = { res ? res : reply };
+        bool ok = false;
+        sendCommands(cmds, replies, &ok, 1);
+        return ok;
+    }
+    return (cmd[0] == res[0]);
+}
 
-        if (!res)
+bool IndiAstrolink4::sendCommands(const char * const cmds[], char * res[], bool ok[], size_t count, const uint32_t aborts[])
+{
+    bool allOk = true;
+    size_t first = 0;
+    while(first < count)
+    {
+        if(isSimulation() && !replay.isActive())
         {
-            tcflush(PortFD, TCIOFLUSH);
-            return true;
+            std::atomic<uint32_t> *axis = aborts ? moveAbortsFor(cmds[first]) : nullptr;
+            if(axis && *axis != aborts[first])
+            {
+                LOGF_DEBUG("Dropped %s queued before an abort", cmds[first]);
+                ok[first] = allOk = false;
+                first++;
+                continue;
+            }
+            ok[first] = sendCommand(cmds[first], res[first]);
+            if(CommandStats *stats = statsFor(cmds[first]))
+            {
+                stats->requests++;
+                stats->mismatches += ok[first] ? 0 : 1;
+            }
+            allOk = allOk && ok[first];
+            first++;
+            continue;
         }
 
-        if ( (tty_rc = tty_nread_section(PortFD, res, ASTROLINK4_LEN, stopChar, ASTROLINK4_TIMEOUT, &nbytes_read)) != TTY_OK || nbytes_read == 1)
+        // fail fast while the link is down instead of waiting for every timeout
+        if(linkLost && !replay.isActive())
+        {
+            for(; first < count; first++)
+                ok[first] = false;
             return false;
+        }
+
+        // as many commands as fit into the firmware receive buffer go out in one write
+        char command[ASTROLINK4_RX_BUFFER + ASTROLINK4_LEN];
+        size_t len = 0, last = first;
+        std::atomic<uint32_t> *guard = nullptr;
+        uint32_t expected = 0;
+        while(last < count)
+        {
+            // a move goes out alone, checked against the aborts right at the write
+            std::atomic<uint32_t> *axis = aborts ? moveAbortsFor(cmds[last]) : nullptr;
+            size_t cmdLen = strnlen(cmds[last], ASTROLINK4_LEN - 1);
+            if(last > first && (axis || guard || len + cmdLen + 1 > ASTROLINK4_RX_BUFFER - ASTROLINK4_ABORT_RESERVE))
+                break;
+            if(axis)
+            {
+                guard = axis;
+                expected = aborts[last];
+            }
+            memcpy(command + len, cmds[last], cmdLen);
+            command[len + cmdLen] = '\n';
+            len += cmdLen + 1;
+            last++;
+        }
+        command[len] = '\0';
+
+        // whatever arrived since the last exchange is a late reply, keep it rather than flush it
+        char line[ASTROLINK4_LEN];
+        while(pendingReply(line, ASTROLINK4_LEN))
+            if(!abortAck(line))
+                keepUnsolicited(line);
+
+        // one span per round trip, from the write to the last reply of the burst
+        Astrolink4::TraceSpan span("burst", "serial", command, len);
+        LOGF_DEBUG("CMD %s", command);
+        size_t next = first;
+        bool timedOut = false, replied = false, failed = false;
+        std::chrono::steady_clock::time_point sentAt = std::chrono::steady_clock::now();
+        bool written = writeBurst(command, len, guard, expected);
+        if (!written && errno == ECANCELED)
+        {
+            // a guarded burst holds just the move
+            LOGF_DEBUG("Dropped %s queued before an abort", cmds[first]);
+            ok[first] = allOk = false;
+            first = last;
+            continue;
+        }
+        for(size_t i = first; i < last; i++)
+            if(CommandStats *stats = statsFor(cmds[i]))
+                stats->requests++;
+        if (written)
+        {
+            // bounded so that a device flooding unrelated lines cannot keep us here
+            size_t readsLeft = 2 * (last - first) + 2;
+            while(next < last && readsLeft-- > 0)
+            {
+                Astrolink4::LineReader::Result rc = readReply(line, ASTROLINK4_LEN, ASTROLINK4_TIMEOUT * 1000);
+                if (rc != Astrolink4::LineReader::LINE)
+                {
+                    if (rc == Astrolink4::LineReader::FAILURE)
+                        LOGF_ERROR("Serial error: %s", strerror(errno));
+                    failed = rc == Astrolink4::LineReader::FAILURE;
+                    timedOut = rc == Astrolink4::LineReader::TIMEOUT;
+                    break;
+                }
+                if (line[0] == '\0')
+                    continue;
+                LOGF_DEBUG("RES %s", line);
+
+                // a reply to a later command means the replies in between were lost
+                size_t match = next;
+                while(match < last && cmds[match][0] != line[0])
+                    match++;
+                if(match == last)
+                {
+                    if(abortAck(line))
+                        continue;
+                    if(CommandStats *stats = statsFor(cmds[next]))
+                        stats->mismatches++;
+                    keepUnsolicited(line);
+                    continue;
+                }
+                for(; next < match; next++)
+                {
+                    ok[next] = false;
+                    if(CommandStats *stats = statsFor(cmds[next]))
+                        stats->mismatches++;
+                }
+                strncpy(res[match], line, ASTROLINK4_LEN);
+                ok[match] = true;
+                replied = true;
+                if(CommandStats *stats = statsFor(cmds[match]))
+                    stats->roundTrip.record(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sentAt).count());
+                next = match + 1;
+            }
+        }
+        else
+        {
+            LOGF_ERROR("Serial error: %s", strerror(errno));
+            failed = true;
+        }
+        // the command and its replies reach the file together
+        transcript.flush();
 
-        tcflush(PortFD, TCIOFLUSH);
-        res[nbytes_read - 1] = '\0';
-        LOGF_DEBUG("RES %s", res);
+        silentExchanges = replied ? 0 : silentExchanges + (timedOut ? 1 : 0);
+        if((failed || silentExchanges >= ASTROLINK4_LINK_TIMEOUTS) && !replay.isActive())
+            linkLost = true;
+        for(; next < last; next++)
+        {
+            ok[next] = false;
+            if(timedOut)
+                if(CommandStats *stats = statsFor(cmds[next]))
+                    stats->timeouts++;
+        }
+
+        for(size_t i = first; i < last; i++)
+            allOk = allOk && ok[i];
+        first = last;
+    }
+    return allOk;
+}
 
-        if (tty_rc != TTY_OK)
+bool IndiAstrolink4::writeBurst(const char *data, size_t len, const std::atomic<uint32_t> *aborts, uint32_t expected)
+{
+    if(replay.isActive())
+    {
+        if(aborts != nullptr && *aborts != expected)
         {
-            char errorMessage[MAXRBUF];
-            tty_error_msg(tty_rc, errorMessage, MAXRBUF);
-            LOGF_ERROR("Serial error: %s", errorMessage);
+            errno = ECANCELED;
             return false;
         }
+        return replay.write(data, len);
     }
-    return (cmd[0] == res[0]);
+    bool ok = reader.writeAll(data, len, aborts, expected);
+    int error = errno;
+    // a burst dropped for an abort never reached the port
+    if(ok || error != ECANCELED)
+        transcript.record(Astrolink4::TranscriptEntry::COMMAND, data, len);
+    if(!ok && error != ECANCELED)
+        transcript.record(Astrolink4::TranscriptEntry::FAILURE, "", 0);
+    errno = error;
+    return ok;
+}
+
+Astrolink4::LineReader::Result IndiAstrolink4::readReply(char *line, size_t size, int timeoutMs)
+{
+    if(replay.isActive())
+        return replay.read(line, size);
+    Astrolink4::LineReader::Result rc = reader.readLine(line, size, timeoutMs);
+    switch(rc)
+    {
+        case Astrolink4::LineReader::LINE:
+            transcript.record(Astrolink4::TranscriptEntry::REPLY, line, strlen(line));
+            break;
+        case Astrolink4::LineReader::TIMEOUT:
+            transcript.record(Astrolink4::TranscriptEntry::TIMEOUT, "", 0);
+            break;
+        default:
+            transcript.record(Astrolink4::TranscriptEntry::FAILURE, "", 0);
+            break;
+    }
+    return rc;
+}
+
+bool IndiAstrolink4::pendingReply(char *line, size_t size)
+{
+    if(replay.isActive())
+        return replay.pendingLine(line, size);
+    if(!reader.pendingLine(line, size))
+        return false;
+    transcript.record(Astrolink4::TranscriptEntry::LATE, line, strlen(line));
+    return true;
+}
+
+bool IndiAstrolink4::startReplay(bool realTime)
+{
+    if(!isSimulation())
+    {
+        LOG_ERROR("Transcript replay needs simulation mode.");
+        return false;
+    }
+    if(replayRunning)
+    {
+        LOG_ERROR("Previous replay is still stopping.");
+        return false;
+    }
+    std::vector<Astrolink4::TranscriptEntry> entries;
+    if(!Astrolink4::loadTranscript(TranscriptFileT[0].text, entries))
+    {
+        LOGF_ERROR("Cannot read serial transcript %s.", TranscriptFileT[0].text);
+        return false;
+    }
+    if(replayRunner.joinable())
+        replayRunner.join();
+    LOGF_INFO("Replaying %zu transcript entries from %s%s.", entries.size(), TranscriptFileT[0].text, realTime ? "" : " as fast as possible");
+    replay.start(std::move(entries), realTime);
+    replayRunning = true;
+    replayRunner = std::thread(&IndiAstrolink4::runReplay, this);
+    return true;
+}
+
+void IndiAstrolink4::stopReplay()
+{
+    replay.stop();
+    if(replayRunner.joinable())
+        replayRunner.join();
+}
+
+void IndiAstrolink4::runReplay()
+{
+    Astrolink4::TranscriptEntry event;
+    while(replay.nextEvent(event))
+    {
+        // every event runs on the worker like the recorded one, the next waits for it to finish
+        std::promise<void> done;
+        std::future<void> finished = done.get_future();
+        bool posted = worker.post([this, &event, &done]()
+        {
+            switch(event.kind)
+            {
+                case Astrolink4::TranscriptEntry::POLL:
+                    sensorRead(static_cast<uint8_t>(event.value));
+                    break;
+                case Astrolink4::TranscriptEntry::MOVE:
+                    MoveAbsFocuser(event.value);
+                    break;
+                case Astrolink4::TranscriptEntry::ABORT:
+                    AbortFocuser();
+                    break;
+                default:
+                    break;
+            }
+            done.set_value();
+        });
+        if(!posted)
+            break;
+        finished.wait();
+    }
+
+    Astrolink4::TranscriptReplay::Stats stats = replay.stats();
+    replay.stop();
+    // published from the worker, this thread never takes the property lock
+    queueTask([]()
+    {
+        return true;
+    }, [this, stats](bool)
+    {
+        TranscriptStatsN[0].value = stats.events;
+        TranscriptStatsN[1].value = stats.matched;
+        TranscriptStatsN[2].value = stats.diverged;
+        TranscriptStatsN[3].value = stats.skipped;
+        TranscriptStatsNP.s = stats.diverged ? IPS_ALERT : IPS_OK;
+        IDSetNumber(&TranscriptStatsNP, nullptr);
+        if(TranscriptS[TRANSCRIPT_REPLAY].s == ISS_ON || TranscriptS[TRANSCRIPT_REPLAY_FAST].s == ISS_ON)
+        {
+            IUResetSwitch(&TranscriptSP);
+            TranscriptS[TRANSCRIPT_OFF].s = ISS_ON;
+            TranscriptSP.s = IPS_OK;
+            IDSetSwitch(&TranscriptSP, nullptr);
+        }
+        LOGF_INFO("Replay finished: %llu events, %llu bursts matched, %llu diverged, %llu skipped.",
+                  static_cast<unsigned long long>(stats.events), static_cast<unsigned long long>(stats.matched),
+                  static_cast<unsigned long long>(stats.diverged), static_cast<unsigned long long>(stats.skipped));
+    });
+    replayRunning = false;
+}
+
+IndiAstrolink4::CommandStats *IndiAstrolink4::statsFor(const char *cmd)
+{
+    const char *letter = strchr(STAT_COMMANDS, cmd[0]);
+    return (cmd[0] != '\0' && letter != nullptr) ? &commandStats[letter - STAT_COMMANDS] : nullptr;
+}
+
+void IndiAstrolink4::updateSerialStats()
+{
+    // the poll jitter and abort times are recorded off the worker under the property lock
+    std::lock_guard<std::recursive_mutex> lock(propertyLock);
+    for(int i = 0; i < STAT_COMMAND_COUNT; i++)
+    {
+        const CommandStats &stats = commandStats[i];
+        SerialStatsN[i * 5].value = stats.requests;
+        SerialStatsN[i * 5 + 1].value = stats.timeouts;
+        SerialStatsN[i * 5 + 2].value = stats.mismatches;
+        SerialStatsN[i * 5 + 3].value = stats.roundTrip.percentile(0.50);
+        SerialStatsN[i * 5 + 4].value = stats.roundTrip.percentile(0.99);
+    }
+    SerialStatsN[STAT_COMMAND_COUNT * 5].value = pollJitter.percentile(0.50);
+    SerialStatsN[STAT_COMMAND_COUNT * 5 + 1].value = pollJitter.percentile(0.99);
+    SerialStatsN[STAT_COMMAND_COUNT * 5 + 2].value = abortWire.percentile(0.50);
+    SerialStatsN[STAT_COMMAND_COUNT * 5 + 3].value = abortWire.percentile(0.99);
+    SerialStatsN[STAT_COMMAND_COUNT * 5 + 4].value = abortWire.max();
+}
+
+void IndiAstrolink4::keepUnsolicited(const char *line)
+{
+    unsolicitedLines++;
+    strncpy(lastUnsolicited, line, sizeof(lastUnsolicited) - 1);
+    LOGF_DEBUG("Unsolicited %s (%llu so far)", line, static_cast<unsigned long long>(unsolicitedLines));
 }
 
 //////////////////////////////////////////////////////////////////////
 /// Sensors
 //////////////////////////////////////////////////////////////////////
-bool IndiAstrolink4::sensorRead()
+bool IndiAstrolink4::sensorRead(uint8_t subsystems)
 {
+    Astrolink4::TraceSpan span("sensorRead", "poll");
     char res[ASTROLINK4_LEN] = {0};
-    if (sendCommand("q", res))
+    char resU[ASTROLINK4_LEN] = {0}, resJ[ASTROLINK4_LEN] = {0}, resE[ASTROLINK4_LEN] = {0};
+    char resF[ASTROLINK4_LEN] = {0}, resN[ASTROLINK4_LEN] = {0}, resP[ASTROLINK4_LEN] = {0};
+    bool refreshSettings = false, refreshManual = false, refreshOther = false;
+    bool holdU = false, holdJ = false, holdE = false;
+    if(subsystems & POLL_SETTINGS)
     {
-        std::vector<std::string> result = split(res, ":");
+        std::lock_guard<std::recursive_mutex> lock(propertyLock);
+        refreshSettings = FocuserSettingsNP.s != IPS_OK || FocuserModeSP.s != IPS_OK || PowerDefaultOnSP.s != IPS_OK || BuzzerSP.s != IPS_OK || FocuserCompModeSP.s != IPS_OK;
+        // a frame with a write queued is left alone, the write publishes it once confirmed
+        holdU = settingsHeld('u');
+        holdJ = settingsHeld('j');
+        holdE = settingsHeld('e');
+        refreshManual = FocuserManualSP.s != IPS_OK && !settingsHeld('f');
+        refreshOther = OtherSettingsNP.s != IPS_OK && !settingsHeld('n');
+    }
 
-        float focuserPosition = std::stod(result[Q_STEPPER_POS]);
+    // serial traffic first in one pipelined burst, properties are updated below in one locked section
+    const char *cmds[6];
+    char *replies[6];
+    bool ok[6] = { false };
+    size_t count = 0;
+    auto add = [&](const char *cmd, char *reply)
+    {
+        cmds[count] = cmd;
+        replies[count] = reply;
+        return static_cast<int>(count++);
+    };
+    // settings frames come from the shadow copy, the device is asked only for frames never fetched
+    bool uOk = refreshSettings && !holdU && shadowU.isValid();
+    bool jOk = refreshSettings && !holdJ && shadowJ.isValid();
+    bool eOk = refreshSettings && !holdE && shadowE.isValid();
+    bool nOk = refreshOther && shadowN.isValid();
+
+    int idxQ = (subsystems & POLL_TELEMETRY) ? add("q", res) : -1;
+    int idxP = (idxQ < 0 && (subsystems & POLL_POSITION)) ? add("p", resP) : -1;
+    int idxU = (refreshSettings && !holdU && !uOk) ? add("u", resU) : -1;
+    int idxJ = (refreshSettings && !holdJ && !jOk) ? add("j", resJ) : -1;
+    int idxE = (refreshSettings && !holdE && !eOk) ? add("e", resE) : -1;
+    int idxF = refreshManual ? add("f", resF) : -1;
+    int idxN = (refreshOther && !nOk) ? add("n", resN) : -1;
+    if(count > 0)
+        sendCommands(cmds, replies, ok, count);
+
+    Astrolink4::QFrame frame;
+    bool frameOk = idxQ >= 0 && ok[idxQ] && Astrolink4::decodeQFrame(res, frame);
+    if (frameOk)
+    {
+        uint64_t nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                             std::chrono::system_clock::now().time_since_epoch()).count();
+        telemetryHistory.append(Astrolink4::TelemetrySample::fromFrame(frame, nowMs));
+        if (frame.isFull() && telemetryArchive.isOpen() && !telemetryArchive.append(frame, nowMs))
+        {
+            telemetryArchive.close();
+            LOG_ERROR("Telemetry archive rotation failed, archiving stopped.");
+        }
+    }
+    uOk = uOk || (idxU >= 0 && ok[idxU] && shadowU.parse(resU));
+    jOk = jOk || (idxJ >= 0 && ok[idxJ] && shadowJ.parse(resJ));
+    eOk = eOk || (idxE >= 0 && ok[idxE] && shadowE.parse(resE));
+    int32_t position = 0;
+    bool positionOk = idxP >= 0 && ok[idxP] && Astrolink4::decodePFrame(resP, position);
+    Astrolink4::FFrame frameF;
+    bool fOk = idxF >= 0 && ok[idxF] && frameF.parse(resF);
+    nOk = nOk || (idxN >= 0 && ok[idxN] && shadowN.parse(resN));
+
+    std::lock_guard<std::recursive_mutex> lock(propertyLock);
+    // fixed buffer, the most frequent reply does not allocate on every poll
+    if (frameOk)
+        memcpy(lastQFrame, res, ASTROLINK4_LEN);
+    if (fOk)
+        stateCache["f"] = resF;
+    if (positionOk && trackPosition)
+    {
+        // the move may be over, steps to go and the final state come with the next full frame
+        if(movesAcked == movesQueued &&
+                (position == FocusAbsPosNP[0].getValue() || position == static_cast<int32_t>(focuserTarget)))
+            fullFrameDue = true;
+        FocusAbsPosNP[0].setValue(position);
+        FocusPosMMN[0].value = position * FocuserSettingsN[FS_STEP_SIZE].value / 1000.0;
+        publishNumber(&FocusPosMMNP);
+        publishFocuser(FocusAbsPosNP);
+    }
+    if (frameOk)
+    {
+        // a frame requested before the queued 'R' went out still shows the focuser at rest
+        bool moveQueued = movesAcked != movesQueued;
+        bool stepping = frame.stepsToGo != 0 || moveQueued;
+        focuserMoving = stepping || frame.dcMove || dcSequenceActive || backlashPhase == BACKLASH_OVERSHOOT;
+        trackPosition = stepping || backlashPhase == BACKLASH_OVERSHOOT;
+        finishRequest(this);
+
+        float focuserPosition = frame.stepperPos;
         FocusAbsPosNP[0].setValue(focuserPosition);
         FocusPosMMN[0].value = focuserPosition * FocuserSettingsN[FS_STEP_SIZE].value / 1000.0;
-        float stepsToGo = std::stod(result[Q_STEPS_TO_GO]);
-        if(stepsToGo == 0)
-        {
-        	if(requireBacklashReturn)
-        	{
-        		requireBacklashReturn = false;
-        		MoveAbsFocuser(focuserPosition - backlashSteps);
-        	}
+        // the overshoot leg ending is handled by watchBacklash(), the move is done after the return leg
+        if(!stepping && backlashPhase != BACKLASH_OVERSHOOT)
+        {
+            backlashPhase = BACKLASH_NONE;
             FocusPosMMNP.s = IPS_OK;
             FocusAbsPosNP.setState(IPS_OK);
             FocusRelPosNP.setState(IPS_OK);
+            finishRequest(&FocusAbsPosNP);
         }
         else
         {
@@ -826,44 +2806,47 @@ bool IndiAstrolink4::sensorRead()
             FocusAbsPosNP.setState(IPS_BUSY);
             FocusRelPosNP.setState(IPS_BUSY);
         }
-        IDSetNumber(&FocusPosMMNP, nullptr);
-        FocusAbsPosNP.apply();
-        FocusRelPosNP.apply();
+        publishNumber(&FocusPosMMNP);
+        publishFocuser(FocusAbsPosNP);
+        publishFocuser(FocusRelPosNP);
 
-        PowerDataN[POW_ITOT].value = std::stod(result[Q_CURRENT]);
+        PowerDataN[POW_ITOT].value = frame.current;
 
-        if(result.size() > 5)
+        if(frame.isFull())
         {
-            if(std::stod(result[Q_SENS1_TYPE]) > 0)
+            if(frame.sens1Type > 0)
             {
-                setParameterValue("WEATHER_TEMPERATURE", std::stod(result[Q_SENS1_TEMP]));
-                setParameterValue("WEATHER_HUMIDITY", std::stod(result[Q_SENS1_HUM]));
-                setParameterValue("WEATHER_DEWPOINT", std::stod(result[Q_SENS1_DEW]));
+                setParameterValue("WEATHER_TEMPERATURE", frame.sens1Temp);
+                setParameterValue("WEATHER_HUMIDITY", frame.sens1Hum);
+                setParameterValue("WEATHER_DEWPOINT", frame.sens1Dew);
             }
                 
-            if(std::stod(result[Q_SENS2_TYPE]) > 0)
+            if(frame.sens2Type > 0)
             {
-                Sensor2N[0].value = std::stod(result[Q_SENS2_TEMP]);
+                Sensor2N[0].value = frame.sens2Temp;
                 Sensor2NP.s = IPS_OK;
-                IDSetNumber(&Sensor2NP, nullptr);
+                if(subsystems & POLL_ENVIRONMENT)
+                    publishNumber(&Sensor2NP, &PublishDeadbandN[DB_TEMPERATURE].value);
             }
             else
             {
                 Sensor2NP.s = IPS_IDLE;
             }
                 
-            PWMN[0].value = std::stod(result[Q_PWM1]);
-            PWMN[1].value = std::stod(result[Q_PWM2]);
+            PWMN[0].value = frame.pwm1;
+            PWMN[1].value = frame.pwm2;
             PWMNP.s = IPS_OK;
-            IDSetNumber(&PWMNP, nullptr);
+            double pwmDeadbands[2] = { PublishDeadbandN[DB_PWM].value, PublishDeadbandN[DB_PWM].value };
+            if(subsystems & POLL_POWER)
+                publishNumber(&PWMNP, pwmDeadbands);
             
-            bool dcMotorMoving = (std::stod(result[Q_DC_MOVE]) > 0);
-            if(dcMotorMoving)
+            // a running sequence reports its own progress
+            if(frame.dcMove && !dcSequenceActive)
             {
                 DCFocTimeNP.s = IPS_BUSY;
-                IDSetNumber(&DCFocTimeNP, nullptr);
+                publishNumber(&DCFocTimeNP);
             }
-            else if (DCFocTimeNP.s == IPS_BUSY)
+            else if (DCFocTimeNP.s == IPS_BUSY && !dcSequenceActive)
             {
                 DCFocTimeNP.s = IPS_OK;
                 DCFocAbortSP.s = IPS_IDLE;
@@ -873,169 +2856,518 @@ bool IndiAstrolink4::sensorRead()
             
             if(Power1SP.s != IPS_OK || Power2SP.s != IPS_OK || Power3SP.s != IPS_OK)
             {
-                Power1S[0].s = (std::stod(result[Q_OUT1]) > 0) ? ISS_ON : ISS_OFF;
-                Power1S[1].s = (std::stod(result[Q_OUT1]) == 0) ? ISS_ON : ISS_OFF;
+                Power1S[0].s = frame.out1 ? ISS_ON : ISS_OFF;
+                Power1S[1].s = frame.out1 ? ISS_OFF : ISS_ON;
                 Power1SP.s = IPS_OK;
                 IDSetSwitch(&Power1SP, nullptr);
-                Power2S[0].s = (std::stod(result[Q_OUT2]) > 0) ? ISS_ON : ISS_OFF;
-                Power2S[1].s = (std::stod(result[Q_OUT2]) == 0) ? ISS_ON : ISS_OFF;
+                finishRequest(&Power1SP);
+                Power2S[0].s = frame.out2 ? ISS_ON : ISS_OFF;
+                Power2S[1].s = frame.out2 ? ISS_OFF : ISS_ON;
                 Power2SP.s = IPS_OK;
                 IDSetSwitch(&Power2SP, nullptr);
-                Power3S[0].s = (std::stod(result[Q_OUT3]) > 0) ? ISS_ON : ISS_OFF;
-                Power3S[1].s = (std::stod(result[Q_OUT3]) == 0) ? ISS_ON : ISS_OFF;
+                finishRequest(&Power2SP);
+                Power3S[0].s = frame.out3 ? ISS_ON : ISS_OFF;
+                Power3S[1].s = frame.out3 ? ISS_OFF : ISS_ON;
                 Power3SP.s = IPS_OK;
                 IDSetSwitch(&Power3SP, nullptr);
+                finishRequest(&Power3SP);
             }
             
-            CompensationValueN[0].value = std::stod(result[Q_COMP_DIFF]);
-            CompensateNowSP.s = CompensationValueNP.s = (CompensationValueN[0].value > 0) ? IPS_OK : IPS_IDLE;
-            CompensateNowS[0].s = (CompensationValueN[0].value > 0) ? ISS_OFF : ISS_ON;
-            IDSetNumber(&CompensationValueNP, nullptr);
-            IDSetSwitch(&CompensateNowSP, nullptr);
+            if(DriverCompS[DRIVER_COMP_ON].s == ISS_ON)
+                compensate(frame);
+            else
+                CompensationValueN[0].value = frame.compDiff;
+            CompensateNowSP.s = CompensationValueNP.s = (CompensationValueN[0].value != 0) ? IPS_OK : IPS_IDLE;
+            CompensateNowS[0].s = (CompensationValueN[0].value != 0) ? ISS_OFF : ISS_ON;
+            publishNumber(&CompensationValueNP);
+            publishSwitch(&CompensateNowSP);
             
-            PowerDataN[POW_VIN].value = std::stod(result[Q_VIN]);
-            PowerDataN[POW_VREG].value = std::stod(result[Q_VREG]);
-            PowerDataN[POW_AH].value = std::stod(result[Q_AH]);
-            PowerDataN[POW_WH].value = std::stod(result[Q_WH]);
+            PowerDataN[POW_VIN].value = frame.vin;
+            PowerDataN[POW_VREG].value = frame.vreg;
+            PowerDataN[POW_AH].value = frame.ah;
+            PowerDataN[POW_WH].value = frame.wh;
 
-            if(strcmp(result[Q_OP_FLAG].c_str(), "0"))
+            if(frame.opFlag != 0)
             {
-            	int opFlag = std::stoi(result[Q_OP_FLAG]);
             	LOGF_WARN("Protection triggered, outputs were disabled. Reason: %s was too high, value: %.1f",
-            			(opFlag == 1) ? "voltage" : "current", std::stod(result[Q_OP_VALUE]));
+            			(frame.opFlag == 1) ? "voltage" : "current", frame.opValue);
             }
         }
 
         PowerDataNP.s=IPS_OK;
-        IDSetNumber(&PowerDataNP, nullptr);
+        double powerDeadbands[5];
+        powerDeadbands[POW_VIN] = powerDeadbands[POW_VREG] = PublishDeadbandN[DB_VOLTAGE].value;
+        powerDeadbands[POW_ITOT] = PublishDeadbandN[DB_CURRENT].value;
+        powerDeadbands[POW_AH] = powerDeadbands[POW_WH] = PublishDeadbandN[DB_ENERGY].value;
+        if(subsystems & POLL_POWER)
+            publishNumber(&PowerDataNP, powerDeadbands);
 
     }
 
     // update settings data if was changed
-    if(FocuserSettingsNP.s != IPS_OK || FocuserModeSP.s != IPS_OK || PowerDefaultOnSP.s != IPS_OK || BuzzerSP.s != IPS_OK || FocuserCompModeSP.s != IPS_OK)
+    applySettings((refreshSettings && uOk) ? &shadowU : nullptr, (refreshSettings && jOk) ? &shadowJ : nullptr,
+                  (refreshSettings && eOk) ? &shadowE : nullptr, (refreshManual && fOk) ? &frameF : nullptr,
+                  (refreshOther && nOk) ? &shadowN : nullptr, IPS_OK, true);
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if(subsystems & POLL_SETTINGS)
     {
-        if (sendCommand("u", res))
+        // frames the device did not return are asked for again later, not on every tick
+        settingsAttempts = settingsStale() ? settingsAttempts + 1 : 0;
+        if(settingsAttempts > 0)
+        {
+            int backoff = std::min(ASTROLINK4_SETTINGS_RETRY_MIN << std::min(settingsAttempts - 1, 6), ASTROLINK4_SETTINGS_RETRY_MAX);
+            LOGF_DEBUG("Settings read incomplete, next attempt in %d ms", backoff);
+            nextSettingsRead = now + std::chrono::milliseconds(backoff);
+        }
+    }
+    if(now - statsPublishedAt >= std::chrono::duration<double>(PublishDeadbandN[DB_MAX_INTERVAL].value))
+    {
+        statsPublishedAt = now;
+        IDSetNumber(&PublishStatsNP, nullptr);
+        IDSetNumber(&PollStatsNP, nullptr);
+        IDSetNumber(&LatencyNP, nullptr);
+        updateSerialStats();
+        IDSetNumber(&SerialStatsNP, nullptr);
+    }
+
+    return true;
+}
+
+void IndiAstrolink4::applySettings(const Astrolink4::UFrame *u, const Astrolink4::JFrame *j, const Astrolink4::EFrame *e,
+                                   const Astrolink4::FFrame *f, const Astrolink4::NFrame *n, IPState state, bool publish)
+{
+    using namespace Astrolink4;
+    if (u)
+    {
+        long mode = u->get<UField::StepperMode>();
+        FocuserModeS[FS_MODE_UNI].s = (mode == 0) ? ISS_ON : ISS_OFF;
+        FocuserModeS[FS_MODE_BI].s = (mode == 1) ? ISS_ON : ISS_OFF;
+        FocuserModeS[FS_MODE_MICRO].s = (mode == 2) ? ISS_ON : ISS_OFF;
+        FocuserModeSP.s = state;
+
+        PowerDefaultOnS[0].s = u->get<UField::Out1Default>() ? ISS_ON : ISS_OFF;
+        PowerDefaultOnS[1].s = u->get<UField::Out2Default>() ? ISS_ON : ISS_OFF;
+        PowerDefaultOnS[2].s = u->get<UField::Out3Default>() ? ISS_ON : ISS_OFF;
+        PowerDefaultOnSP.s = state;
+
+        FocuserSettingsN[FS_SPEED].value = u->get<UField::Speed>();
+        FocuserSettingsN[FS_STEP_SIZE].value = u->get<UField::StepSize>();
+        FocusMaxPosNP[0].setValue(u->get<UField::MaxPos>());
+        FocusMaxPosNP.setState(state);
+        if (publish)
         {
-            std::vector<std::string> result = split(res, ":");
-            
-            FocuserModeS[FS_MODE_UNI].s = FocuserModeS[FS_MODE_BI].s = FocuserModeS[FS_MODE_MICRO].s = ISS_OFF;
-            if(!strcmp("0", result[U_STEPPER_MODE].c_str())) FocuserModeS[FS_MODE_UNI].s = ISS_ON;
-            if(!strcmp("1", result[U_STEPPER_MODE].c_str())) FocuserModeS[FS_MODE_BI].s = ISS_ON;
-            if(!strcmp("2", result[U_STEPPER_MODE].c_str())) FocuserModeS[FS_MODE_MICRO].s = ISS_ON;
-            FocuserModeSP.s = IPS_OK;
             IDSetSwitch(&FocuserModeSP, nullptr);
-            
-            PowerDefaultOnS[0].s = (std::stod(result[U_OUT1_DEF]) > 0) ? ISS_ON : ISS_OFF;
-            PowerDefaultOnS[1].s = (std::stod(result[U_OUT2_DEF]) > 0) ? ISS_ON : ISS_OFF;
-            PowerDefaultOnS[2].s = (std::stod(result[U_OUT3_DEF]) > 0) ? ISS_ON : ISS_OFF;
-            PowerDefaultOnSP.s = IPS_OK;
+            finishRequest(&FocuserModeSP);
             IDSetSwitch(&PowerDefaultOnSP, nullptr);
-            
-            FocuserSettingsN[FS_SPEED].value = std::stod(result[U_SPEED]);
-            FocuserSettingsN[FS_STEP_SIZE].value = std::stod(result[U_STEPSIZE]) / 100.0;
-            FocusMaxPosNP[0].setValue(std::stod(result[U_MAX_POS]));
+            finishRequest(&PowerDefaultOnSP);
             IDSetNumber(&FocuserSettingsNP, nullptr);
-            FocusMaxPosNP.setState(IPS_OK);
             FocusMaxPosNP.apply();
         }
+    }
 
-        if(sendCommand("j", res))
+    if (j)
+    {
+        BuzzerS[0].s = j->get<JField::Buzzer>() ? ISS_ON : ISS_OFF;
+        BuzzerSP.s = state;
+        if (publish)
         {
-            std::vector<std::string> result = split(res, ":");
-            BuzzerS[0].s = (std::stod(result[1]) > 0) ? ISS_ON : ISS_OFF;
-            BuzzerSP.s = IPS_OK;
             IDSetSwitch(&BuzzerSP, nullptr);
+            finishRequest(&BuzzerSP);
         }
+    }
 
-        if (sendCommand("e", res))
+    if (e)
+    {
+        FocuserSettingsN[FS_COMPENSATION].value = e->get<EField::Steps>();
+        FocuserSettingsN[FS_COMP_THRESHOLD].value = e->get<EField::Trigger>();
+        FocuserSettingsNP.s = state;
+
+        bool automatic = e->get<EField::Auto>();
+        FocuserCompModeS[FS_COMP_MANUAL].s = automatic ? ISS_OFF : ISS_ON;
+        FocuserCompModeS[FS_COMP_AUTO].s = automatic ? ISS_ON : ISS_OFF;
+        FocuserCompModeSP.s = state;
+        if (publish)
         {
-            std::vector<std::string> result = split(res, ":");
-            FocuserSettingsN[FS_COMPENSATION].value = std::stod(result[E_COMP_STEPS]) / 100.0;
-            FocuserSettingsN[FS_COMP_THRESHOLD].value = std::stod(result[E_COMP_TRGR]);
-            FocuserSettingsNP.s = IPS_OK;
             IDSetNumber(&FocuserSettingsNP, nullptr);
-
-            FocuserCompModeS[FS_COMP_MANUAL].s = (std::stod(result[E_COMP_AUTO]) == 0) ? ISS_ON : ISS_OFF;
-            FocuserCompModeS[FS_COMP_AUTO].s = (std::stod(result[E_COMP_AUTO]) > 0) ? ISS_ON : ISS_OFF;
-            FocuserCompModeSP.s = IPS_OK;
+            finishRequest(&FocuserSettingsNP);
             IDSetSwitch(&FocuserCompModeSP, nullptr);
+            finishRequest(&FocuserCompModeSP);
         }
     }
 
-    if(FocuserManualSP.s != IPS_OK)
+    if (f)
     {
-        if (sendCommand("f", res))
+        bool manual = f->get<FField::Manual>();
+        FocuserManualS[FS_MANUAL_OFF].s = manual ? ISS_OFF : ISS_ON;
+        FocuserManualS[FS_MANUAL_ON].s = manual ? ISS_ON : ISS_OFF;
+        FocuserManualSP.s = state;
+        if (publish)
         {
-            std::vector<std::string> result = split(res, ":");
-            FocuserManualS[FS_MANUAL_OFF].s = (std::stod(result[1]) == 0) ? ISS_ON : ISS_OFF;
-            FocuserManualS[FS_MANUAL_ON].s = (std::stod(result[1]) > 0) ? ISS_ON : ISS_OFF;
-            FocuserManualSP.s = IPS_OK;
             IDSetSwitch(&FocuserManualSP, nullptr);
+            finishRequest(&FocuserManualSP);
         }
     }
 
-    if(OtherSettingsNP.s != IPS_OK)
+    if (n)
     {
-        if (sendCommand("n", res))
+        OtherSettingsN[SET_AREF_COEFF].value = n->get<NField::ArefCoeff>();
+        OtherSettingsN[SET_OVER_TIME].value = n->get<NField::OverTime>();
+        OtherSettingsN[SET_OVER_VOLT].value = n->get<NField::OverVolt>();
+        OtherSettingsN[SET_OVER_AMP].value = n->get<NField::OverAmp>();
+        OtherSettingsNP.s = state;
+        if (publish)
         {
-            std::vector<std::string> result = split(res, ":");
-            OtherSettingsN[SET_AREF_COEFF].value = std::stod(result[N_AREF_COEFF]) / 1000.0;
-            OtherSettingsN[SET_OVER_TIME].value = std::stod(result[N_OVER_TIME]);
-            OtherSettingsN[SET_OVER_VOLT].value = std::stod(result[N_OVER_VOLT]) / 10.0;
-            OtherSettingsN[SET_OVER_AMP].value = std::stod(result[N_OVER_AMP]) / 10.0;
-            OtherSettingsNP.s = IPS_OK;
             IDSetNumber(&OtherSettingsNP, nullptr);
+            finishRequest(&OtherSettingsNP);
         }
     }
+}
+
+bool IndiAstrolink4::hasChanged(const void *key, const char *name, const double *values, const double *deadbands, int count,
+                                int state)
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    PublishedSnapshot &last = publishedSnapshots[key];
+    last.name = name;
+
+    bool changed = last.state != state || static_cast<int>(last.values.size()) != count ||
+                   now - last.at >= std::chrono::duration<double>(PublishDeadbandN[DB_MAX_INTERVAL].value);
+    for(int i = 0; i < count && !changed; i++)
+    {
+        double delta = std::fabs(values[i] - last.values[i]);
+        changed = delta > 0 && delta >= (deadbands ? deadbands[i] : 0);
+    }
+
+    if(!changed)
+    {
+        PublishStatsN[PUB_SUPPRESSED].value++;
+        return false;
+    }
+    last.values.assign(values, values + count);
+    last.state = state;
+    last.at = now;
+    PublishStatsN[PUB_SENT].value++;
+    return true;
+}
+
+void IndiAstrolink4::publishNumber(INumberVectorProperty *nvp, const double *deadbands)
+{
+    Astrolink4::TraceSpan span("publish", "publish", nvp->name);
+    double values[8];
+    int count = std::min(nvp->nnp, 8);
+    for(int i = 0; i < count; i++)
+        values[i] = nvp->np[i].value;
+    if(hasChanged(nvp, nvp->name, values, deadbands, count, nvp->s))
+        IDSetNumber(nvp, nullptr);
+}
+
+void IndiAstrolink4::publishSwitch(ISwitchVectorProperty *svp)
+{
+    Astrolink4::TraceSpan span("publish", "publish", svp->name);
+    double values[8];
+    int count = std::min(svp->nsp, 8);
+    for(int i = 0; i < count; i++)
+        values[i] = svp->sp[i].s;
+    if(hasChanged(svp, svp->name, values, nullptr, count, svp->s))
+        IDSetSwitch(svp, nullptr);
+}
+
+void IndiAstrolink4::publishFocuser(INDI::PropertyNumber &property)
+{
+    Astrolink4::TraceSpan span("publish", "publish", property.getName());
+    double value = property[0].getValue();
+    if(hasChanged(&property, property.getName(), &value, nullptr, 1, property.getState()))
+        property.apply();
+}
+
+void IndiAstrolink4::startRequest(const void *key, int category)
+{
+    pendingRequests[key] = std::make_pair(category, std::chrono::steady_clock::now());
+}
+
+void IndiAstrolink4::finishRequest(const void *key)
+{
+    auto pending = pendingRequests.find(key);
+    if(pending == pendingRequests.end())
+        return;
+
+    int category = pending->second.first;
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - pending->second.second).count();
+    pendingRequests.erase(pending);
+
+    Astrolink4::LatencyHistogram &histogram = requestLatency[category];
+    histogram.record(ms);
+    LatencyN[category * 4].value = histogram.count();
+    LatencyN[category * 4 + 1].value = histogram.percentile(0.50);
+    LatencyN[category * 4 + 2].value = histogram.percentile(0.95);
+    LatencyN[category * 4 + 3].value = histogram.percentile(0.99);
+}
+
+bool IndiAstrolink4::exportLatency(const char *path)
+{
+    FILE *fp = fopen(path, "w");
+    if(fp == nullptr)
+    {
+        LOGF_ERROR("Cannot write latency statistics to %s: %s", path, strerror(errno));
+        return false;
+    }
+
+    const char *categories[LAT_COUNT] = { "move", "power", "settings", "connect", "recovery" };
+    fprintf(fp, "{\n  \"device\": \"%s\",\n  \"version\": \"%d.%d\",\n  \"latency_ms\": {\n", getDeviceName(), VERSION_MAJOR, VERSION_MINOR);
+    for(int i = 0; i < LAT_COUNT; i++)
+    {
+        const Astrolink4::LatencyHistogram &histogram = requestLatency[i];
+        fprintf(fp, "    \"%s\": { \"count\": %llu, \"p50\": %.3f, \"p95\": %.3f, \"p99\": %.3f, \"max\": %.3f }%s\n",
+                categories[i], static_cast<unsigned long long>(histogram.count()), histogram.percentile(0.50),
+                histogram.percentile(0.95), histogram.percentile(0.99), histogram.max(), i + 1 < LAT_COUNT ? "," : "");
+    }
+    fprintf(fp, "  }\n}\n");
+    fclose(fp);
+    LOGF_INFO("Latency statistics written to %s", path);
+    return true;
+}
+
+bool IndiAstrolink4::exportTelemetry()
+{
+    using namespace std::chrono;
+    uint64_t nowMs = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+    uint64_t rangeMs = static_cast<uint64_t>(TelemetryRangeN[0].value * 60000);
+    std::vector<Astrolink4::TelemetrySample> samples = telemetryHistory.snapshot(nowMs > rangeMs ? nowMs - rangeMs : 0);
+    if(samples.empty())
+    {
+        LOG_WARN("No telemetry recorded in the requested range");
+        return false;
+    }
 
+    bool csv = TelemetryFormatS[TELEMETRY_CSV].s == ISS_ON;
+    if(csv)
+        Astrolink4::TelemetryHistory::formatCsv(samples, telemetryBlob);
+    else
+        Astrolink4::TelemetryHistory::formatBinary(samples, telemetryBlob);
+
+    TelemetryB[0].blob = telemetryBlob.data();
+    TelemetryB[0].bloblen = TelemetryB[0].size = telemetryBlob.size();
+    strncpy(TelemetryB[0].format, csv ? ".csv" : ".al4t", MAXINDIBLOBFMT);
+    TelemetryBP.s = IPS_OK;
+    IDSetBLOB(&TelemetryBP, nullptr);
+    LOGF_INFO("Exported %u telemetry samples", static_cast<unsigned>(samples.size()));
     return true;
 }
 
+void IndiAstrolink4::invalidatePublished()
+{
+    // every vector was republished outside the snapshots, resend everything on the next poll
+    publishedSnapshots.clear();
+}
+
+void IndiAstrolink4::invalidatePublished(const char *name)
+{
+    // a client request or command completion published this vector on its own
+    if(name == nullptr)
+        return;
+    for(auto it = publishedSnapshots.begin(); it != publishedSnapshots.end(); ++it)
+    {
+        if(it->second.name != nullptr && !strcmp(it->second.name, name))
+        {
+            publishedSnapshots.erase(it);
+            return;
+        }
+    }
+}
+
 //////////////////////////////////////////////////////////////////////
 /// Helper functions
 //////////////////////////////////////////////////////////////////////
-std::vector<std::string> IndiAstrolink4::split(const std::string &input, const std::string &regex)
+template <class Frame>
+bool IndiAstrolink4::updateSettings(Frame &shadow, const Astrolink4::SettingsPatch<Frame> &patch)
+{
+    char cmd[ASTROLINK4_LEN] = {0}, res[ASTROLINK4_LEN] = {0};
+    if(!shadow.isValid())
+    {
+        // not fetched at connect, read it once
+        const char getCom[2] = { Frame::GET, '\0' };
+        if(!sendCommand(getCom, res) || !shadow.parse(res))
+            return false;
+    }
+
+    patch.applyTo(shadow);
+    if(shadow.encode(cmd, ASTROLINK4_LEN) == 0 || !sendCommand(cmd, res))
+    {
+        shadow.discard();
+        return false;
+    }
+
+    // confirmed, the device now holds exactly what was sent
+    if(!shadow.commit())
+        return false;
+    // polls left this frame alone meanwhile, nothing else publishes the new values
+    std::lock_guard<std::recursive_mutex> lock(propertyLock);
+    publishShadow(shadow);
+    return true;
+}
+
+void IndiAstrolink4::publishShadow(const Astrolink4::UFrame &u)
 {
-    // passing -1 as the submatch index parameter performs splitting
-    std::regex re(regex);
-    std::sregex_token_iterator
-    first{input.begin(), input.end(), re, -1},
-          last;
-    return {first, last};
+    applySettings(&u, nullptr, nullptr, nullptr, nullptr, IPS_OK, true);
 }
 
-std::string IndiAstrolink4::doubleToStr(double val)
+void IndiAstrolink4::publishShadow(const Astrolink4::JFrame &j)
 {
-    char buf[10];
-    sprintf(buf, "%.0f", val);
-    return std::string(buf);
+    applySettings(nullptr, &j, nullptr, nullptr, nullptr, IPS_OK, true);
 }
 
-bool IndiAstrolink4::updateSettings(const char * getCom, const char * setCom, int index, const char * value)
+void IndiAstrolink4::publishShadow(const Astrolink4::EFrame &e)
 {
-	std::map<int, std::string> values;
-	values[index] = value;
-    return updateSettings(getCom, setCom, values);
+    applySettings(nullptr, nullptr, &e, nullptr, nullptr, IPS_OK, true);
 }
 
-bool IndiAstrolink4::updateSettings(const char * getCom, const char * setCom, std::map<int, std::string> values)
+void IndiAstrolink4::publishShadow(const Astrolink4::NFrame &n)
 {
-    char cmd[ASTROLINK4_LEN] = {0}, res[ASTROLINK4_LEN] = {0};
-    snprintf(cmd, ASTROLINK4_LEN, "%s", getCom);
-    if(sendCommand(cmd, res))
+    applySettings(nullptr, nullptr, nullptr, nullptr, &n, IPS_OK, true);
+}
+
+void IndiAstrolink4::queueSettings(const char *frames, std::function<bool()> task, std::function<void(bool)> done)
+{
+    holdSettings(frames, 1);
+    queueTask(task, [this, frames, done](bool allOk)
     {
-        std::string concatSettings = "";
-        std::vector<std::string> result = split(res, ":");
-        if(result.size() >= values.size())
-        {
-            result[0] = setCom;
-            for(std::map<int, std::string>::iterator it = values.begin(); it != values.end(); ++it)
-            	result[it->first] = it->second;
+        holdSettings(frames, -1);
+        if(done)
+            done(allOk);
+    });
+}
 
-            for (const auto &piece : result) concatSettings += piece + ":";
-            snprintf(cmd, ASTROLINK4_LEN, "%s", concatSettings.c_str());
-            if(sendCommand(cmd, res)) return true;
-        }
+void IndiAstrolink4::holdSettings(const char *frames, int delta)
+{
+    std::lock_guard<std::recursive_mutex> lock(propertyLock);
+    for(const char *frame = frames; *frame != '\0'; frame++)
+        settingsWrites[*frame] += delta;
+}
+
+bool IndiAstrolink4::settingsHeld(char frame)
+{
+    auto writes = settingsWrites.find(frame);
+    return writes != settingsWrites.end() && writes->second > 0;
+}
+
+std::string IndiAstrolink4::archivePath()
+{
+    const char *home = getenv("HOME");
+    std::string name = getDeviceName();
+    std::replace(name.begin(), name.end(), ' ', '_');
+    return std::string(home ? home : "/tmp") + "/.indi/" + name + "_telemetry.al4a";
+}
+
+void IndiAstrolink4::configureArchive()
+{
+    bool enable = ArchiveS[ARCHIVE_ON].s == ISS_ON;
+    std::string path = ArchiveFileT[0].text;
+    uint64_t maxBytes = static_cast<uint64_t>(ArchiveLimitsN[ARCHIVE_SIZE].value) * 1024 * 1024;
+    int keep = static_cast<int>(ArchiveLimitsN[ARCHIVE_KEEP].value);
+    ArchiveSP.s = IPS_BUSY;
+    IDSetSwitch(&ArchiveSP, nullptr);
+    // the archive belongs to the worker, reopening picks up a new file or rotation limits
+    queueTask([this, enable, path, maxBytes, keep]()
+    {
+        telemetryArchive.close();
+        return !enable || telemetryArchive.open(path, maxBytes, keep);
+    }, [this, enable, path](bool allOk)
+    {
+        if(!allOk)
+            LOGF_ERROR("Cannot open telemetry archive %s.", path.c_str());
+        ArchiveSP.s = allOk ? (enable ? IPS_OK : IPS_IDLE) : IPS_ALERT;
+        IDSetSwitch(&ArchiveSP, nullptr);
+    });
+}
+
+std::string IndiAstrolink4::stateCachePath()
+{
+    const char *home = getenv("HOME");
+    std::string name = getDeviceName();
+    std::replace(name.begin(), name.end(), ' ', '_');
+    return std::string(home ? home : "/tmp") + "/.indi/" + name + "_state.txt";
+}
+
+void IndiAstrolink4::loadStateCache()
+{
+    std::ifstream file(stateCachePath());
+    std::string line;
+    while(std::getline(file, line))
+    {
+        // one frame per line as received, keyed by its command letter
+        if(line.size() <= 2 || line.size() >= ASTROLINK4_LEN || line[1] != ':' || !strchr("uenjfq", line[0]))
+            continue;
+        if(line[0] == 'q')
+            memcpy(lastQFrame, line.c_str(), line.size() + 1);
+        else
+            stateCache[line.substr(0, 1)] = line;
+    }
+}
+
+void IndiAstrolink4::saveStateCache()
+{
+    const Astrolink4::FrameText *shadows[] = { &shadowU, &shadowE, &shadowN, &shadowJ };
+    for(const Astrolink4::FrameText *shadow : shadows)
+        if(shadow->isValid())
+            stateCache[std::string(1, shadow->str()[0])] = shadow->str();
+
+    // written aside and renamed, a crash never leaves a truncated cache behind
+    std::string path = stateCachePath();
+    std::string temporary = path + ".tmp";
+    FILE *fp = fopen(temporary.c_str(), "w");
+    if(fp == nullptr)
+    {
+        LOGF_DEBUG("Cannot write state cache %s: %s", temporary.c_str(), strerror(errno));
+        return;
+    }
+    for(const auto &frame : stateCache)
+        fprintf(fp, "%s\n", frame.second.c_str());
+    if(lastQFrame[0] != '\0')
+        fprintf(fp, "%s\n", lastQFrame);
+    if(fclose(fp) != 0 || rename(temporary.c_str(), path.c_str()) != 0)
+        LOGF_DEBUG("Cannot write state cache %s: %s", path.c_str(), strerror(errno));
+}
+
+void IndiAstrolink4::applyCachedState()
+{
+    if(stateCache.empty() && lastQFrame[0] == '\0')
+        loadStateCache();
+
+    auto cached = [this](const char *key) -> const char *
+    {
+        std::map<std::string, std::string>::const_iterator frame = stateCache.find(key);
+        return frame == stateCache.end() ? "" : frame->second.c_str();
+    };
+
+    // cached values stay IDLE so that the regular refresh confirms them with the device
+    Astrolink4::UFrame u;
+    Astrolink4::JFrame j;
+    Astrolink4::EFrame e;
+    Astrolink4::FFrame f;
+    Astrolink4::NFrame n;
+    applySettings(u.parse(cached("u")) ? &u : nullptr, j.parse(cached("j")) ? &j : nullptr, e.parse(cached("e")) ? &e : nullptr,
+                  f.parse(cached("f")) ? &f : nullptr, n.parse(cached("n")) ? &n : nullptr, IPS_IDLE, false);
+
+    Astrolink4::QFrame frame;
+    if(!Astrolink4::decodeQFrame(lastQFrame, frame))
+        return;
+    FocusAbsPosNP[0].setValue(frame.stepperPos);
+    FocusPosMMN[0].value = frame.stepperPos * FocuserSettingsN[FS_STEP_SIZE].value / 1000.0;
+    PowerDataN[POW_ITOT].value = frame.current;
+    if(frame.isFull())
+    {
+        PowerDataN[POW_VIN].value = frame.vin;
+        PowerDataN[POW_VREG].value = frame.vreg;
+        PowerDataN[POW_AH].value = frame.ah;
+        PowerDataN[POW_WH].value = frame.wh;
+        PWMN[0].value = frame.pwm1;
+        PWMN[1].value = frame.pwm2;
+        Power1S[0].s = frame.out1 ? ISS_ON : ISS_OFF;
+        Power1S[1].s = frame.out1 ? ISS_OFF : ISS_ON;
+        Power2S[0].s = frame.out2 ? ISS_ON : ISS_OFF;
+        Power2S[1].s = frame.out2 ? ISS_OFF : ISS_ON;
+        Power3S[0].s = frame.out3 ? ISS_ON : ISS_OFF;
+        Power3S[1].s = frame.out3 ? ISS_OFF : ISS_ON;
     }
-	return false;
 }
@@ -26,67 +26,35 @@
 #include <fcntl.h>
 #include <termios.h>
 #include <memory>
-#include <regex>
 #include <cstring>
 #include <map>
 #include <sstream>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <chrono>
+#include <thread>
+#include <future>
 
 #include <defaultdevice.h>
 #include <indifocuserinterface.h>
 #include <indiweatherinterface.h>
 #include <connectionplugins/connectionserial.h>
 
-#define Q_STEPPER_POS		1
-#define Q_STEPS_TO_GO		2
-#define Q_CURRENT			3
-#define Q_SENS1_TYPE		4
-#define Q_SENS1_TEMP		5
-#define Q_SENS1_HUM			6
-#define Q_SENS1_DEW			7
-#define Q_SENS2_TYPE		8
-#define Q_SENS2_TEMP		9
-#define Q_PWM1				10
-#define Q_PWM2				11
-#define Q_OUT1				12
-#define Q_OUT2				13
-#define Q_OUT3				14
-#define Q_VIN				15
-#define Q_VREG				16
-#define Q_AH				17
-#define Q_WH				18
-#define Q_DC_MOVE			19
-#define Q_COMP_DIFF			20
-#define Q_OP_FLAG			21
-#define Q_OP_VALUE			22
-
-#define U_MAX_POS			1
-#define U_SPEED				2
-#define U_PWMSTOP			3
-#define U_PWMRUN			4
-#define U_ACC				5
-#define U_REVERSED			6
-#define U_STEPPER_MODE		7
-#define U_COMPSENS			8
-#define U_STEPSIZE			9
-#define U_PWMPRESC			10
-#define U_STEPPRESC			11
-#define U_BUZ_ENABLED		12
-#define U_HUM_SENS			13
-#define U_DC_REVERSED		14
-#define U_OUT1_DEF			15
-#define U_OUT2_DEF			16
-#define U_OUT3_DEF			17
-
-#define E_COMP_CYCLE		1
-#define E_COMP_STEPS		2
-#define E_COMP_SENSR		3
-#define E_COMP_AUTO			4
-#define E_COMP_TRGR			5
-
-#define N_AREF_COEFF		1
-#define N_OVER_VOLT			2
-#define N_OVER_AMP			3
-#define N_OVER_TIME			4
+#include "astrolink4_archive.h"
+#include "astrolink4_compensation.h"
+#include "astrolink4_config.h"
+#include "astrolink4_history.h"
+#include "astrolink4_protocol.h"
+#include "astrolink4_reactor.h"
+#include "astrolink4_reader.h"
+#include "astrolink4_stats.h"
+#include "astrolink4_trace.h"
+#include "astrolink4_transcript.h"
+#include "astrolink4_worker.h"
+
+// longest command or reply line
+#define ASTROLINK4_LEN      100
 
 namespace Connection
 {
@@ -97,19 +65,31 @@ class IndiAstrolink4 : public INDI::DefaultDevice, public INDI::FocuserInterface
 {
 
 public:
-    IndiAstrolink4();
+    // units after the first get the unit number appended to their name
+    // reactor and configuration writer are shared by all units of the process
+    IndiAstrolink4(Astrolink4::SerialReactor *reactor, Astrolink4::ConfigWriter *configWriter, int unit = 1);
+    virtual ~IndiAstrolink4();
     virtual bool initProperties();
     virtual bool updateProperties();
 	
     virtual bool ISNewNumber (const char *dev, const char *name, double values[], char *names[], int n);
     virtual bool ISNewSwitch (const char *dev, const char *name, ISState *states, char *names[], int n);
     virtual bool ISNewText(const char * dev, const char * name, char * texts[], char * names[], int n);
+    virtual bool ISSnoopDevice(XMLEle *root) override;
 	
 protected:
     virtual const char *getDefaultName();
     virtual void TimerHit();
+    virtual bool Connect() override;
+    virtual bool Disconnect() override;
     virtual bool saveConfigItems(FILE *fp);
+    // snapshots the configuration, the file is written by configWriter
+    virtual bool saveConfig(bool silent = false, const char *property = nullptr) override;
     virtual bool sendCommand(const char * cmd, char * res);
+    // writes all commands at once and matches the replies in order by their echoed first character
+    // with aborts, a move is dropped unless its axis saw exactly that many aborts when it is written
+    virtual bool sendCommands(const char * const cmds[], char * res[], bool ok[], size_t count,
+                              const uint32_t aborts[] = nullptr);
 
     // Focuser Overrides
     virtual IPState MoveAbsFocuser(uint32_t targetTicks) override;
@@ -133,17 +113,250 @@ private:
     virtual bool Handshake();
     int PortFD = -1;
     Connection::Serial *serialConnection { nullptr };
-    bool updateSettings(const char * getCom, const char * setCom, int index, const char * value);
-    bool updateSettings(const char * getCom, const char * setCom, std::map<int, std::string> values);
-    std::vector<std::string> split(const std::string &input, const std::string &regex);
-    std::string doubleToStr(double val);
-    bool sensorRead();
+    // serial traffic runs on the worker, completion callbacks run with propertyLock held
+    Astrolink4::SerialWorker worker;
+    std::recursive_mutex propertyLock;
+    std::atomic<bool> pollQueued { false };
+
+    // fixed rate scheduler, each subsystem is polled at its own period
+    enum
+    {
+        POLL_FOCUSER = 1, POLL_POWER = 2, POLL_ENVIRONMENT = 4, POLL_SETTINGS = 8,
+        POLL_TELEMETRY = POLL_FOCUSER | POLL_POWER | POLL_ENVIRONMENT,
+        // short 'p' query, position only while the stepper moves
+        POLL_POSITION = 16
+    };
+    std::atomic<uint8_t> pollPending { 0 };
+    std::atomic<bool> focuserMoving { false };
+    // stepper move in progress, tracked with 'p' and full 'q' frames interleaved at a lower rate
+    std::atomic<bool> trackPosition { false };
+    // the stepper reached its target or stopped, the next poll confirms it with a full frame
+    std::atomic<bool> fullFrameDue { false };
+    // the timer sleeps until the earliest deadline, the fast rate applies only while the focuser moves
+    std::chrono::steady_clock::time_point nextTick;
+    std::chrono::steady_clock::time_point nextDue[3];
+    std::chrono::steady_clock::time_point nextFullFrame;
+    // failed settings reads are retried with a growing delay
+    std::chrono::steady_clock::time_point nextSettingsRead;
+    int settingsAttempts { 0 };
+    bool settingsStale();
+    // event loop timers are not thread safe, only the thread that created the unit re-arms the poll
+    std::thread::id eventThread { std::this_thread::get_id() };
+    int pollTimer { -1 };
+    std::chrono::steady_clock::time_point pollTimerAt;
+    void wakePoll(std::chrono::steady_clock::time_point at);
+    void pollFocuserSoon();
+    // routine polls held back while the snooped camera reads out, client commands still go out
+    bool busQuiet { false };
+    // the longest pause ran out, polling stays on until the exposure ends
+    bool quietExpired { false };
+    std::chrono::steady_clock::time_point quietSince;
+    void updateQuiet();
+    void resetSchedule();
+    uint8_t dueSubsystems(std::chrono::steady_clock::time_point now);
+    // property names the vector done publishes directly, its delta snapshot is dropped before
+    void queueTask(std::function<bool()> task, std::function<void(bool)> done, const char *property = nullptr);
+    void queueCommand(const std::string &cmd, std::function<void(bool)> done, const char *property = nullptr);
+    // commands queued back to back are coalesced into one pipelined write
+    struct PendingCommand
+    {
+        std::string cmd;
+        std::function<void(bool)> done;
+        // aborts of the axis seen when queued, a move queued before an abort is dropped
+        uint32_t aborts;
+        const char *property;
+    };
+    typedef std::vector<PendingCommand> CommandBatch;
+    std::mutex batchLock;
+    std::shared_ptr<CommandBatch> openBatch;
+    void flushCommands(std::shared_ptr<CommandBatch> batch);
+    // 'H' and 'K' skip the queue and are written from the calling thread
+    std::atomic<uint32_t> stepperAborts { 0 };
+    std::atomic<uint32_t> dcAborts { 0 };
+    // acks of aborts written outside the worker, swallowed by whichever read sees them
+    std::atomic<int> pendingAbortAcks { 0 };
+    // abort request to the command written, guarded by propertyLock
+    Astrolink4::LatencyHistogram abortWire;
+    std::atomic<uint32_t> *abortsFor(char letter);
+    // the abort counter a move command is checked against, nullptr for anything else
+    std::atomic<uint32_t> *moveAbortsFor(const char *cmd);
+    void sendAbort(const char *cmd, std::function<void(bool)> done);
+    bool abortAck(const char *line);
+    template <class Frame>
+    bool updateSettings(Frame &shadow, const Astrolink4::SettingsPatch<Frame> &patch);
+    void publishShadow(const Astrolink4::UFrame &u);
+    void publishShadow(const Astrolink4::JFrame &j);
+    void publishShadow(const Astrolink4::EFrame &e);
+    void publishShadow(const Astrolink4::NFrame &n);
+    // settings writes, frames names the frames the task writes by their letters; polls leave
+    // those frames alone until it completed, a stale read would publish the old values as OK
+    void queueSettings(const char *frames, std::function<bool()> task, std::function<void(bool)> done);
+    void holdSettings(const char *frames, int delta);
+    // under propertyLock
+    bool settingsHeld(char frame);
+    std::map<char, int> settingsWrites;
+    // last known u/e/n/j frames, used only on the worker once connected
+    Astrolink4::UFrame shadowU;
+    Astrolink4::EFrame shadowE;
+    Astrolink4::NFrame shadowN;
+    Astrolink4::JFrame shadowJ;
+    void applySettings(const Astrolink4::UFrame *u, const Astrolink4::JFrame *j, const Astrolink4::EFrame *e,
+                       const Astrolink4::FFrame *f, const Astrolink4::NFrame *n, IPState state, bool publish);
+
+    // last frames received from the device, kept on disk to show real values right after connect
+    std::map<std::string, std::string> stateCache;
+    // the 'q' frame comes with every poll, it stays out of the map
+    char lastQFrame[ASTROLINK4_LEN] = {0};
+    std::string stateCachePath();
+    void loadStateCache();
+    void saveStateCache();
+    void applyCachedState();
+    bool sensorRead(uint8_t subsystems = POLL_TELEMETRY | POLL_SETTINGS);
+
+    // delta publishing, a vector is sent only when a value moved past its deadband,
+    // its state changed or the forced refresh interval elapsed
+    struct PublishedSnapshot
+    {
+        std::vector<double> values;
+        const char *name { nullptr };
+        int state { -1 };
+        std::chrono::steady_clock::time_point at;
+    };
+    std::map<const void *, PublishedSnapshot> publishedSnapshots;
+    std::chrono::steady_clock::time_point statsPublishedAt;
+    bool hasChanged(const void *key, const char *name, const double *values, const double *deadbands, int count, int state);
+    void publishNumber(INumberVectorProperty *nvp, const double *deadbands = nullptr);
+    void publishSwitch(ISwitchVectorProperty *svp);
+    void publishFocuser(INDI::PropertyNumber &property);
+    void invalidatePublished();
+    void invalidatePublished(const char *name);
+
+    // end-to-end latency from a client request to the state confirmed by the device
+    enum
+    {
+        LAT_MOVE, LAT_POWER, LAT_SETTINGS, LAT_CONNECT, LAT_RECOVERY, LAT_COUNT
+    };
+    Astrolink4::LatencyHistogram requestLatency[LAT_COUNT];
+    std::map<const void *, std::pair<int, std::chrono::steady_clock::time_point>> pendingRequests;
+    void startRequest(const void *key, int category);
+    void finishRequest(const void *key);
+    bool exportLatency(const char *path);
+
+    // serial link statistics per command letter, updated on the worker
+    struct CommandStats
+    {
+        uint64_t requests { 0 };
+        uint64_t timeouts { 0 };
+        uint64_t mismatches { 0 };
+        Astrolink4::LatencyHistogram roundTrip;
+    };
+    // one slot per letter of STAT_COMMANDS
+    static const int STAT_COMMAND_COUNT = 20;
+    CommandStats commandStats[STAT_COMMAND_COUNT];
+    // lateness of the poll timer, recorded by TimerHit under propertyLock
+    Astrolink4::LatencyHistogram pollJitter;
+    CommandStats *statsFor(const char *cmd);
+    void updateSerialStats();
+
+    // link supervision, the worker reports a lost link and TimerHit reconnects with backoff
+    enum LinkState
+    {
+        LINK_UP, LINK_LOST, LINK_RECONNECTING
+    };
+    LinkState linkState { LINK_UP };
+    std::atomic<bool> linkLost { false };
+    // bursts without a single reply in a row, worker only
+    int silentExchanges { 0 };
+    int reconnectAttempts { 0 };
+    std::chrono::steady_clock::time_point linkLostAt;
+    std::chrono::steady_clock::time_point nextReconnect;
+    bool handshakeDevice(bool publish);
+    bool reopenPort(const std::string &port, uint32_t baud);
+    void markLinkLost();
+    void startReconnect();
+
+    // shared by all units of the process, receives on the serial port
+    Astrolink4::SerialReactor *reactor { nullptr };
+    std::string unitName;
+
+    // decoded 'q' frames, appended by the serial worker only
+    Astrolink4::TelemetryHistory telemetryHistory;
+    // keeps the last exported BLOB alive until the next export
+    std::vector<char> telemetryBlob;
+    bool exportTelemetry();
+    // full 'q' frames kept on disk, opened and appended on the worker, closed once it stopped
+    Astrolink4::TelemetryArchive telemetryArchive;
+    std::string archivePath();
+    void configureArchive();
+    // persists saveConfig() snapshots in the background, flushed before a load and on shutdown
+    Astrolink4::ConfigWriter *configWriter { nullptr };
+    // set by the first successful write, under propertyLock
+    bool defaultConfigSaved { false };
+    // resolved once in initProperties, empty until the device has its name
+    std::string configPath;
+    void resolveConfigPath();
     bool setAutoPWM();
+    // driver side temperature compensation, fed from full 'q' frames on the worker
+    Astrolink4::TemperatureCompensator compensator;
+    std::chrono::steady_clock::time_point compensatorSampleAt;
+    void compensate(const Astrolink4::QFrame &frame);
+    bool compensationMove(int32_t steps);
+    // MoveAbsFocuser for client moves, compensationMove for the driver's own
+    IPState startMove(uint32_t targetTicks, bool client);
+    bool focuserBusy();
     int32_t calculateBacklash(uint32_t targetTicks);
     char stopChar { 0xA };	// new line
+    // owned by the worker thread once connected
+    Astrolink4::LineReader reader { stopChar };
+    // serial transcript, recorded from any thread; replayed in simulation mode by the runner thread
+    Astrolink4::TranscriptWriter transcript;
+    Astrolink4::TranscriptReplay replay;
+    std::thread replayRunner;
+    std::atomic<bool> replayRunning { false };
+    bool startReplay(bool realTime);
+    void stopReplay();
+    void runReplay();
+    bool writeBurst(const char *data, size_t len, const std::atomic<uint32_t> *aborts = nullptr, uint32_t expected = 0);
+    Astrolink4::LineReader::Result readReply(char *line, size_t size, int timeoutMs);
+    bool pendingReply(char *line, size_t size);
+    uint64_t unsolicitedLines = 0;
+    char lastUnsolicited[100] = {0};
+    void keepUnsolicited(const char *line);
     bool backlashEnabled = false;
     int32_t backlashSteps = 0;
-    bool requireBacklashReturn = false;
+    // backlash compensated move: overshoot leg watched closely by the worker, then the return leg
+    enum BacklashPhase
+    {
+        BACKLASH_NONE, BACKLASH_OVERSHOOT, BACKLASH_RETURN
+    };
+    BacklashPhase backlashPhase { BACKLASH_NONE };
+    uint32_t backlashTarget { 0 };
+    // position the stepper is heading to with the last 'R' command
+    uint32_t focuserTarget { 0 };
+    // bumped by every new move or abort, a watch belonging to an older move stops
+    uint32_t backlashMove { 0 };
+    // 'R' commands queued by startMove() and completed by the worker, under propertyLock. While they
+    // differ a frame may predate the move and its zero steps to go do not end it
+    uint32_t movesQueued { 0 };
+    uint32_t movesAcked { 0 };
+    void watchBacklash(uint32_t move, bool confirm = false);
+    // DC focuser pulses run back to back on the worker, each one as soon as the previous ended
+    struct DcPulse
+    {
+        bool inward;
+        int pwm;
+        int periodMs;
+    };
+    std::vector<DcPulse> dcSequence;
+    bool dcSequenceActive { false };
+    // bumped by every new sequence, single pulse or stop, pulses of an older run are dropped
+    uint32_t dcSequenceRun { 0 };
+    bool parseDcSequence(const char *text, std::vector<DcPulse> &pulses);
+    void startDcSequence(const std::vector<DcPulse> &pulses);
+    void cancelDcSequence();
+    void finishDcSequence(uint32_t run, IPState state);
+    void startDcPulse(uint32_t run, uint32_t aborts, size_t index);
+    void watchDcPulse(uint32_t run, uint32_t aborts, size_t index, std::chrono::steady_clock::time_point end);
     
     IText PowerControlsLabelsT[3];
     ITextVectorProperty PowerControlsLabelsTP;
@@ -179,6 +392,15 @@ private:
     ISwitch CompensateNowS[1];
     ISwitchVectorProperty CompensateNowSP;
 
+    ISwitch DriverCompS[2];
+    ISwitchVectorProperty DriverCompSP;
+    enum
+    {
+        DRIVER_COMP_ON, DRIVER_COMP_OFF
+    };
+    INumber CompFilterN[1];
+    INumberVectorProperty CompFilterNP;
+
     INumber FocuserSettingsN[4];
     INumberVectorProperty FocuserSettingsNP;
     enum
@@ -229,13 +451,134 @@ private:
     ISwitch DCFocAbortS[1];
     ISwitchVectorProperty DCFocAbortSP;
 
+    IText DCFocSequenceT[1];
+    ITextVectorProperty DCFocSequenceTP;
+
     ISwitch BuzzerS[1];
     ISwitchVectorProperty BuzzerSP;
+
+    INumber PublishDeadbandN[6];
+    INumberVectorProperty PublishDeadbandNP;
+    enum
+    {
+        DB_VOLTAGE, DB_CURRENT, DB_ENERGY, DB_TEMPERATURE, DB_PWM, DB_MAX_INTERVAL
+    };
+
+    INumber PollRatesN[5];
+    INumberVectorProperty PollRatesNP;
+    enum
+    {
+        RATE_FOCUSER_MOVING, RATE_FOCUSER_IDLE, RATE_POWER, RATE_ENVIRONMENT, RATE_FOCUSER_FULL
+    };
+
+    ISwitch TraceS[2];
+    ISwitchVectorProperty TraceSP;
+    enum
+    {
+        TRACE_ON, TRACE_OFF
+    };
+    ISwitch TraceActionS[1];
+    ISwitchVectorProperty TraceActionSP;
+    IText TraceFileT[1];
+    ITextVectorProperty TraceFileTP;
+
+    IText TranscriptFileT[1];
+    ITextVectorProperty TranscriptFileTP;
+    ISwitch TranscriptS[4];
+    ISwitchVectorProperty TranscriptSP;
+    enum
+    {
+        TRANSCRIPT_OFF, TRANSCRIPT_RECORD, TRANSCRIPT_REPLAY, TRANSCRIPT_REPLAY_FAST
+    };
+    INumber TranscriptStatsN[4];
+    INumberVectorProperty TranscriptStatsNP;
+
+    IText ActiveDeviceT[1];
+    ITextVectorProperty ActiveDeviceTP;
+
+    // exposure of the snooped camera, not defined to clients
+    INumber CcdExposureN[1];
+    INumberVectorProperty CcdExposureNP;
+
+    ISwitch QuietBusS[3];
+    ISwitchVectorProperty QuietBusSP;
+    enum
+    {
+        QUIET_OFF, QUIET_READOUT, QUIET_EXPOSURE
+    };
+    INumber QuietN[2];
+    INumberVectorProperty QuietNP;
+    enum
+    {
+        QUIET_LEAD, QUIET_MAX
+    };
+
+    INumber PollStatsN[3];
+    INumberVectorProperty PollStatsNP;
+    enum
+    {
+        POLL_TICKS, POLL_MISSES, POLL_MAX_LATE
+    };
+
+    INumber LatencyN[LAT_COUNT * 4];
+    INumberVectorProperty LatencyNP;
+
+    IText LatencyFileT[1];
+    ITextVectorProperty LatencyFileTP;
+
+    ISwitch LatencyActionS[2];
+    ISwitchVectorProperty LatencyActionSP;
+    enum
+    {
+        LAT_EXPORT, LAT_RESET
+    };
+
+    INumber SerialStatsN[STAT_COMMAND_COUNT * 5 + 5];
+    INumberVectorProperty SerialStatsNP;
+
+    INumber TelemetryRangeN[1];
+    INumberVectorProperty TelemetryRangeNP;
+
+    ISwitch TelemetryFormatS[2];
+    ISwitchVectorProperty TelemetryFormatSP;
+    enum
+    {
+        TELEMETRY_CSV, TELEMETRY_BINARY
+    };
+
+    ISwitch TelemetryExportS[1];
+    ISwitchVectorProperty TelemetryExportSP;
+
+    IBLOB TelemetryB[1];
+    IBLOBVectorProperty TelemetryBP;
+
+    ISwitch ArchiveS[2];
+    ISwitchVectorProperty ArchiveSP;
+    enum
+    {
+        ARCHIVE_ON, ARCHIVE_OFF
+    };
+    IText ArchiveFileT[1];
+    ITextVectorProperty ArchiveFileTP;
+    INumber ArchiveLimitsN[2];
+    INumberVectorProperty ArchiveLimitsNP;
+    enum
+    {
+        ARCHIVE_SIZE, ARCHIVE_KEEP
+    };
+
+    INumber PublishStatsN[2];
+    INumberVectorProperty PublishStatsNP;
+    enum
+    {
+        PUB_SENT, PUB_SUPPRESSED
+    };
     
     static constexpr const char *POWER_TAB {"Power"};
     static constexpr const char *ENVIRONMENT_TAB {"Environment"};
     static constexpr const char *SETTINGS_TAB {"Settings"};
     static constexpr const char *DCFOCUSER_TAB {"DC Focuser"};
+    static constexpr const char *HISTORY_TAB {"History"};
 };
 
 #endif